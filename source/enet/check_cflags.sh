@@ -32,6 +32,11 @@ CHECK_FUNC fcntl -DHAS_FCNTL
 CHECK_FUNC inet_pton -DHAS_INET_PTON
 CHECK_FUNC inet_ntop -DHAS_INET_NTOP
 
+$CC check_func.c -DTEST_FUN=sendmmsg -o check_func 2>/dev/null && \
+$CC check_func.c -DTEST_FUN=recvmmsg -o check_func 2>/dev/null
+if [ $? -eq 0 ]; then printf " -DHAS_MMSG"; fi
+rm -f check_func
+
 echo "#include <sys/socket.h>" > check_member.h
 $CC check_member.c -DTEST_STRUCT=msghdr -DTEST_FIELD=msg_flags \
     -o check_member 2>/dev/null
@@ -111,6 +111,13 @@ enet_host_create (const ENetAddress * address, size_t peerCount, size_t channelL
 
     host -> intercept = NULL;
 
+    host -> batchLimit = 0;
+    host -> sendBatch = NULL;
+    host -> sendBatchCount = 0;
+    host -> receiveBatch = NULL;
+    host -> receiveBatchCount = 0;
+    host -> receiveBatchIndex = 0;
+
     enet_list_clear (& host -> dispatchQueue);
 
     for (currentPeer = host -> peers;
@@ -157,6 +164,9 @@ enet_host_destroy (ENetHost * host)
     if (host -> compressor.context != NULL && host -> compressor.destroy)
       (* host -> compressor.destroy) (host -> compressor.context);
 
+    if (host -> sendBatch != NULL)
+      enet_free (host -> sendBatch);
+
     enet_free (host -> peers);
     enet_free (host);
 }
@@ -290,6 +300,7 @@ enet_host_broadcast (ENetHost * host, enet_uint8 channelID, ENetPacket * packet)
 /** Sets the packet compressor the host should use to compress and decompress packets.
     @param host host to enable or disable compression for
     @param compressor callbacks for for the packet compressor; if NULL, then compression is disabled
+    @remarks datagrams are only compressed towards peers the application has set ENET_PEER_FLAG_COMPRESS on
 */
 void
 enet_host_compress (ENetHost * host, const ENetCompressor * compressor)
@@ -303,6 +314,53 @@ enet_host_compress (ENetHost * host, const ENetCompressor * compressor)
       host -> compressor.context = NULL;
 }
 
+/** Sets how many datagrams the host moves per socket call.
+    @param host host to configure
+    @param batchLimit datagrams to send or receive per call, at most ENET_HOST_MAXIMUM_BATCH; if 0, then each datagram is sent and received on its own
+    @returns 0 on success, < 0 on failure
+    @remarks a flush copies each outgoing datagram aside and sends them all together once every peer is serviced;
+    datagrams received but not yet processed are dropped when the limit changes
+*/
+int
+enet_host_batch (ENetHost * host, size_t batchLimit)
+{
+    ENetDatagram * datagrams = NULL;
+    enet_uint8 * data;
+    size_t i;
+
+    if (batchLimit > ENET_HOST_MAXIMUM_BATCH)
+      batchLimit = ENET_HOST_MAXIMUM_BATCH;
+
+    if (batchLimit == host -> batchLimit)
+      return 0;
+
+    if (batchLimit > 0)
+    {
+        datagrams = (ENetDatagram *) enet_malloc (2 * batchLimit * (sizeof (ENetDatagram) + ENET_PROTOCOL_MAXIMUM_MTU));
+        if (datagrams == NULL)
+          return -1;
+
+        data = (enet_uint8 *) & datagrams [2 * batchLimit];
+        for (i = 0; i < 2 * batchLimit; ++ i)
+        {
+            datagrams [i].buffer.data = data + i * ENET_PROTOCOL_MAXIMUM_MTU;
+            datagrams [i].buffer.dataLength = ENET_PROTOCOL_MAXIMUM_MTU;
+        }
+    }
+
+    if (host -> sendBatch != NULL)
+      enet_free (host -> sendBatch);
+
+    host -> batchLimit = batchLimit;
+    host -> sendBatch = datagrams;
+    host -> sendBatchCount = 0;
+    host -> receiveBatch = datagrams != NULL ? & datagrams [batchLimit] : NULL;
+    host -> receiveBatchCount = 0;
+    host -> receiveBatchIndex = 0;
+
+    return 0;
+}
+
 /** Limits the maximum allowed channels of future incoming connections.
     @param host host to limit
     @param channelLimit the maximum number of channels allowed; if 0, then this is equivalent to ENET_PROTOCOL_MAXIMUM_CHANNEL_COUNT
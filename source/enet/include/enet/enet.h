@@ -216,6 +216,7 @@ enum
    ENET_HOST_DEFAULT_MTU                  = 1392,
    ENET_HOST_DEFAULT_MAXIMUM_PACKET_SIZE  = 32 * 1024 * 1024,
    ENET_HOST_DEFAULT_MAXIMUM_WAITING_DATA = 32 * 1024 * 1024,
+   ENET_HOST_MAXIMUM_BATCH                = 64,
 
    ENET_PEER_DEFAULT_ROUND_TRIP_TIME      = 500,
    ENET_PEER_DEFAULT_PACKET_THROTTLE      = 32,
@@ -254,7 +255,8 @@ typedef struct _ENetChannel
 typedef enum _ENetPeerFlag
 {
    ENET_PEER_FLAG_NEEDS_DISPATCH   = (1 << 0),
-   ENET_PEER_FLAG_CONTINUE_SENDING = (1 << 1)
+   ENET_PEER_FLAG_CONTINUE_SENDING = (1 << 1),
+   ENET_PEER_FLAG_COMPRESS         = (1 << 2)  /**< datagrams to this peer may be compressed, set by the application */
 } ENetPeerFlag;
 
 /**
@@ -340,6 +342,39 @@ typedef struct _ENetCompressor
    void (ENET_CALLBACK * destroy) (void * context);
 } ENetCompressor;
 
+/** A datagram moved by a batched socket call, see enet_socket_send_multiple() and enet_socket_receive_multiple().
+ */
+typedef struct _ENetDatagram
+{
+   ENetAddress address;
+   ENetBuffer  buffer;
+} ENetDatagram;
+
+/** Free lists that packets, commands and packet data are recycled through, see enet_pool_stats().
+    Each thread has its own lists; define ENET_NO_POOL when building ENet to allocate everything with enet_malloc() instead.
+ */
+typedef enum _ENetPoolClass
+{
+   ENET_POOL_PACKET = 0,
+   ENET_POOL_OUTGOING_COMMAND,
+   ENET_POOL_INCOMING_COMMAND,
+   ENET_POOL_ACKNOWLEDGEMENT,
+   ENET_POOL_DATA_64,
+   ENET_POOL_DATA_256,
+   ENET_POOL_DATA_1024,
+   ENET_POOL_DATA_8192,
+   ENET_POOL_DATA_LARGE,        /**< packet data too large for any class, always allocated with enet_malloc() */
+   ENET_POOL_COUNT
+} ENetPoolClass;
+
+typedef struct _ENetPoolStats
+{
+   enet_uint32 hits;            /**< allocations served from the free list */
+   enet_uint32 misses;          /**< allocations that fell through to enet_malloc() */
+   enet_uint32 overflows;       /**< releases passed to enet_free() because the free list was full */
+   enet_uint32 pooled;          /**< blocks waiting on the free list */
+} ENetPoolStats;
+
 /** Callback that computes the checksum of the data held in buffers[0:bufferCount-1] */
 typedef enet_uint32 (ENET_CALLBACK * ENetChecksumCallback) (const ENetBuffer * buffers, size_t bufferCount);
 
@@ -400,6 +435,12 @@ typedef struct _ENetHost
    size_t               duplicatePeers;              /**< optional number of allowed peers from duplicate IPs, defaults to ENET_PROTOCOL_MAXIMUM_PEER_ID */
    size_t               maximumPacketSize;           /**< the maximum allowable packet size that may be sent or received on a peer */
    size_t               maximumWaitingData;          /**< the maximum aggregate amount of buffer space a peer may use waiting for packets to be delivered */
+   size_t               batchLimit;                  /**< datagrams moved per socket call, 0 if batching is disabled, set with enet_host_batch() */
+   ENetDatagram *       sendBatch;                   /**< copies of the datagrams queued by the current flush */
+   size_t               sendBatchCount;
+   ENetDatagram *       receiveBatch;                /**< datagrams returned by the last batched receive */
+   size_t               receiveBatchCount;
+   size_t               receiveBatchIndex;           /**< next datagram of receiveBatch to be processed */
 } ENetHost;
 
 /**
@@ -504,6 +545,8 @@ ENET_API ENetSocket enet_socket_accept (ENetSocket, ENetAddress *);
 ENET_API int        enet_socket_connect (ENetSocket, const ENetAddress *);
 ENET_API int        enet_socket_send (ENetSocket, const ENetAddress *, const ENetBuffer *, size_t);
 ENET_API int        enet_socket_receive (ENetSocket, ENetAddress *, ENetBuffer *, size_t);
+ENET_API int        enet_socket_send_multiple (ENetSocket, const ENetDatagram *, size_t);
+ENET_API int        enet_socket_receive_multiple (ENetSocket, ENetDatagram *, size_t);
 ENET_API int        enet_socket_wait (ENetSocket, enet_uint32 *, enet_uint32);
 ENET_API int        enet_socket_set_option (ENetSocket, ENetSocketOption, int);
 ENET_API int        enet_socket_get_option (ENetSocket, ENetSocketOption, int *);
@@ -573,6 +616,7 @@ ENET_API void       enet_host_flush (ENetHost *);
 ENET_API void       enet_host_broadcast (ENetHost *, enet_uint8, ENetPacket *);
 ENET_API void       enet_host_compress (ENetHost *, const ENetCompressor *);
 ENET_API int        enet_host_compress_with_range_coder (ENetHost * host);
+ENET_API int        enet_host_batch (ENetHost *, size_t);
 ENET_API void       enet_host_channel_limit (ENetHost *, size_t);
 ENET_API void       enet_host_bandwidth_limit (ENetHost *, enet_uint32, enet_uint32);
 extern   void       enet_host_bandwidth_throttle (ENetHost *);
@@ -608,6 +652,14 @@ ENET_API size_t enet_range_coder_decompress (void *, const enet_uint8 *, size_t,
    
 extern size_t enet_protocol_command_size (enet_uint8);
 
+ENET_API void   enet_pool_stats (ENetPoolStats * stats);
+ENET_API void   enet_pool_clear (void);
+extern   void * enet_pool_alloc (ENetPoolClass);
+extern   void   enet_pool_free (ENetPoolClass, void *);
+extern   void * enet_pool_alloc_data (size_t);
+extern   void   enet_pool_free_data (void *);
+extern   int    enet_pool_data_fits (const void *, size_t);
+
 #ifdef __cplusplus
 }
 #endif
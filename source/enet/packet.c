@@ -19,7 +19,7 @@
 ENetPacket *
 enet_packet_create (const void * data, size_t dataLength, enet_uint32 flags)
 {
-    ENetPacket * packet = (ENetPacket *) enet_malloc (sizeof (ENetPacket));
+    ENetPacket * packet = (ENetPacket *) enet_pool_alloc (ENET_POOL_PACKET);
     if (packet == NULL)
       return NULL;
 
@@ -30,10 +30,10 @@ enet_packet_create (const void * data, size_t dataLength, enet_uint32 flags)
       packet -> data = NULL;
     else
     {
-       packet -> data = (enet_uint8 *) enet_malloc (dataLength);
+       packet -> data = (enet_uint8 *) enet_pool_alloc_data (dataLength);
        if (packet -> data == NULL)
        {
-          enet_free (packet);
+          enet_pool_free (ENET_POOL_PACKET, packet);
           return NULL;
        }
 
@@ -63,8 +63,8 @@ enet_packet_destroy (ENetPacket * packet)
       (* packet -> freeCallback) (packet);
     if (! (packet -> flags & ENET_PACKET_FLAG_NO_ALLOCATE) &&
         packet -> data != NULL)
-      enet_free (packet -> data);
-    enet_free (packet);
+      enet_pool_free_data (packet -> data);
+    enet_pool_free (ENET_POOL_PACKET, packet);
 }
 
 /** Attempts to resize the data in the packet to length specified in the 
@@ -78,19 +78,26 @@ enet_packet_resize (ENetPacket * packet, size_t dataLength)
 {
     enet_uint8 * newData;
    
+#ifdef ENET_NO_POOL
     if (dataLength <= packet -> dataLength || (packet -> flags & ENET_PACKET_FLAG_NO_ALLOCATE))
+#else
+    if ((packet -> flags & ENET_PACKET_FLAG_NO_ALLOCATE) || enet_pool_data_fits (packet -> data, dataLength))
+#endif
     {
        packet -> dataLength = dataLength;
 
        return 0;
     }
 
-    newData = (enet_uint8 *) enet_malloc (dataLength);
+    newData = (enet_uint8 *) enet_pool_alloc_data (dataLength);
     if (newData == NULL)
       return -1;
 
-    memcpy (newData, packet -> data, packet -> dataLength);
-    enet_free (packet -> data);
+    if (packet -> data != NULL)
+    {
+       memcpy (newData, packet -> data, packet -> dataLength < dataLength ? packet -> dataLength : dataLength);
+       enet_pool_free_data (packet -> data);
+    }
     
     packet -> data = newData;
     packet -> dataLength = dataLength;
@@ -0,0 +1,258 @@
+/** 
+ @file  pool.c
+ @brief ENet free lists for packets, commands and packet data
+*/
+#include <string.h>
+#define ENET_BUILDING_LIB 1
+#include "enet/enet.h"
+
+/** @defgroup pool ENet pool functions
+    @{
+*/
+
+#ifndef ENET_NO_POOL
+
+#ifdef _MSC_VER
+#define ENET_POOL_THREAD_LOCAL __declspec(thread)
+#else
+#define ENET_POOL_THREAD_LOCAL __thread
+#endif
+
+enum
+{
+   ENET_POOL_FIRST_DATA = ENET_POOL_DATA_64,
+   ENET_POOL_LARGEST_DATA = 8192
+};
+
+typedef struct _ENetPoolBlock
+{
+   struct _ENetPoolBlock * next;
+} ENetPoolBlock;
+
+/* placed before each block of packet data, so that it can be released without knowing its size */
+typedef struct _ENetPoolHeader
+{
+   size_t poolClass;
+   size_t capacity;
+} ENetPoolHeader;
+
+static const size_t poolSizes [ENET_POOL_COUNT] =
+{
+   sizeof (ENetPacket),
+   sizeof (ENetOutgoingCommand),
+   sizeof (ENetIncomingCommand),
+   sizeof (ENetAcknowledgement),
+   sizeof (ENetPoolHeader) + 64,
+   sizeof (ENetPoolHeader) + 256,
+   sizeof (ENetPoolHeader) + 1024,
+   sizeof (ENetPoolHeader) + ENET_POOL_LARGEST_DATA,
+   0
+};
+
+/* bounds what an idle thread holds on to after a burst */
+static const enet_uint32 poolLimits [ENET_POOL_COUNT] = { 4096, 4096, 4096, 4096, 4096, 4096, 1024, 64, 0 };
+
+static ENET_POOL_THREAD_LOCAL ENetPoolBlock * poolFree [ENET_POOL_COUNT];
+static ENET_POOL_THREAD_LOCAL ENetPoolStats poolStats [ENET_POOL_COUNT];
+
+void *
+enet_pool_alloc (ENetPoolClass poolClass)
+{
+    ENetPoolBlock * block = poolFree [poolClass];
+
+    if (block != NULL)
+    {
+       poolFree [poolClass] = block -> next;
+       -- poolStats [poolClass].pooled;
+       ++ poolStats [poolClass].hits;
+
+       return block;
+    }
+
+    ++ poolStats [poolClass].misses;
+
+    return enet_malloc (poolSizes [poolClass]);
+}
+
+void
+enet_pool_free (ENetPoolClass poolClass, void * memory)
+{
+    ENetPoolBlock * block = (ENetPoolBlock *) memory;
+
+    if (poolStats [poolClass].pooled >= poolLimits [poolClass])
+    {
+       ++ poolStats [poolClass].overflows;
+
+       enet_free (memory);
+
+       return;
+    }
+
+    block -> next = poolFree [poolClass];
+    poolFree [poolClass] = block;
+    ++ poolStats [poolClass].pooled;
+}
+
+static ENetPoolClass
+enet_pool_data_class (size_t size)
+{
+    if (size <= 64)
+      return ENET_POOL_DATA_64;
+    if (size <= 256)
+      return ENET_POOL_DATA_256;
+    if (size <= 1024)
+      return ENET_POOL_DATA_1024;
+    if (size <= ENET_POOL_LARGEST_DATA)
+      return ENET_POOL_DATA_8192;
+    return ENET_POOL_DATA_LARGE;
+}
+
+/** Allocates packet data of at least size bytes from the smallest class that holds it. */
+void *
+enet_pool_alloc_data (size_t size)
+{
+    ENetPoolClass poolClass = enet_pool_data_class (size);
+    ENetPoolHeader * header;
+
+    if (poolClass == ENET_POOL_DATA_LARGE)
+    {
+       ++ poolStats [poolClass].misses;
+
+       header = (ENetPoolHeader *) enet_malloc (sizeof (ENetPoolHeader) + size);
+       if (header == NULL)
+         return NULL;
+
+       header -> capacity = size;
+    }
+    else
+    {
+       header = (ENetPoolHeader *) enet_pool_alloc (poolClass);
+       if (header == NULL)
+         return NULL;
+
+       header -> capacity = poolSizes [poolClass] - sizeof (ENetPoolHeader);
+    }
+
+    header -> poolClass = poolClass;
+
+    return header + 1;
+}
+
+void
+enet_pool_free_data (void * data)
+{
+    ENetPoolHeader * header;
+
+    if (data == NULL)
+      return;
+
+    header = (ENetPoolHeader *) data - 1;
+
+    if (header -> poolClass == ENET_POOL_DATA_LARGE)
+      enet_free (header);
+    else
+      enet_pool_free ((ENetPoolClass) header -> poolClass, header);
+}
+
+/** Returns 1 if the block of packet data can hold size bytes and no smaller class would do,
+    so that shrinking a packet hands an oversized block back to its free list.
+*/
+int
+enet_pool_data_fits (const void * data, size_t size)
+{
+    const ENetPoolHeader * header;
+
+    if (data == NULL)
+      return size == 0;
+
+    header = (const ENetPoolHeader *) data - 1;
+
+    if (size > header -> capacity)
+      return 0;
+
+    return header -> poolClass == ENET_POOL_DATA_LARGE ?
+             size > ENET_POOL_LARGEST_DATA :
+             enet_pool_data_class (size) == (ENetPoolClass) header -> poolClass;
+}
+
+/** Copies the calling thread's pool counters into stats[0:ENET_POOL_COUNT-1]. */
+void
+enet_pool_stats (ENetPoolStats * stats)
+{
+    memcpy (stats, poolStats, sizeof (poolStats));
+}
+
+/** Releases every block pooled by the calling thread, which should be done before the thread exits. */
+void
+enet_pool_clear (void)
+{
+    int poolClass;
+
+    for (poolClass = 0; poolClass < ENET_POOL_COUNT; ++ poolClass)
+    {
+       while (poolFree [poolClass] != NULL)
+       {
+          ENetPoolBlock * block = poolFree [poolClass];
+
+          poolFree [poolClass] = block -> next;
+          enet_free (block);
+       }
+
+       poolStats [poolClass].pooled = 0;
+    }
+}
+
+#else
+
+void *
+enet_pool_alloc (ENetPoolClass poolClass)
+{
+    static const size_t poolSizes [ENET_POOL_DATA_64] =
+    {
+       sizeof (ENetPacket),
+       sizeof (ENetOutgoingCommand),
+       sizeof (ENetIncomingCommand),
+       sizeof (ENetAcknowledgement)
+    };
+
+    return enet_malloc (poolSizes [poolClass]);
+}
+
+void
+enet_pool_free (ENetPoolClass poolClass, void * memory)
+{
+    enet_free (memory);
+}
+
+void *
+enet_pool_alloc_data (size_t size)
+{
+    return enet_malloc (size);
+}
+
+void
+enet_pool_free_data (void * data)
+{
+    enet_free (data);
+}
+
+int
+enet_pool_data_fits (const void * data, size_t size)
+{
+    return 0;
+}
+
+void
+enet_pool_stats (ENetPoolStats * stats)
+{
+    memset (stats, 0, ENET_POOL_COUNT * sizeof (ENetPoolStats));
+}
+
+void
+enet_pool_clear (void)
+{
+}
+
+#endif
+
+/** @} */
@@ -184,7 +184,7 @@ enet_protocol_remove_sent_unreliable_commands (ENetPeer * peer, ENetList * sentU
            }
         }
 
-        enet_free (outgoingCommand);
+        enet_pool_free (ENET_POOL_OUTGOING_COMMAND, outgoingCommand);
     } while (! enet_list_empty (sentUnreliableCommands));
 
     if (peer -> state == ENET_PEER_STATE_DISCONNECT_LATER &&
@@ -279,7 +279,7 @@ enet_protocol_remove_sent_reliable_command (ENetPeer * peer, enet_uint16 reliabl
        }
     }
 
-    enet_free (outgoingCommand);
+    enet_pool_free (ENET_POOL_OUTGOING_COMMAND, outgoingCommand);
 
     if (enet_list_empty (& peer -> sentReliableCommands))
       return commandNumber;
@@ -1238,24 +1238,61 @@ enet_protocol_receive_incoming_commands (ENetHost * host, ENetEvent * event)
        int receivedLength;
        ENetBuffer buffer;
 
-       buffer.data = host -> packetData [0];
-       buffer.dataLength = sizeof (host -> packetData [0]);
+       if (host -> receiveBatch != NULL)
+       {
+          ENetDatagram * datagram;
 
-       receivedLength = enet_socket_receive (host -> socket,
-                                             & host -> receivedAddress,
-                                             & buffer,
-                                             1);
+          if (host -> receiveBatchIndex >= host -> receiveBatchCount)
+          {
+             int receivedCount;
+             size_t i;
 
-       if (receivedLength == -2)
-         continue;
+             for (i = 0; i < host -> batchLimit; ++ i)
+               host -> receiveBatch [i].buffer.dataLength = ENET_PROTOCOL_MAXIMUM_MTU;
 
-       if (receivedLength < 0)
-         return -1;
+             receivedCount = enet_socket_receive_multiple (host -> socket, host -> receiveBatch, host -> batchLimit);
 
-       if (receivedLength == 0)
-         return 0;
+             if (receivedCount < 0)
+               return -1;
+
+             host -> receiveBatchCount = receivedCount;
+             host -> receiveBatchIndex = 0;
+
+             if (receivedCount == 0)
+               return 0;
+          }
+
+          datagram = & host -> receiveBatch [host -> receiveBatchIndex ++];
+
+          if (datagram -> buffer.dataLength == 0)
+            continue;
+
+          host -> receivedAddress = datagram -> address;
+          host -> receivedData = (enet_uint8 *) datagram -> buffer.data;
+          receivedLength = (int) datagram -> buffer.dataLength;
+       }
+       else
+       {
+          buffer.data = host -> packetData [0];
+          buffer.dataLength = sizeof (host -> packetData [0]);
+
+          receivedLength = enet_socket_receive (host -> socket,
+                                                & host -> receivedAddress,
+                                                & buffer,
+                                                1);
+
+          if (receivedLength == -2)
+            continue;
+
+          if (receivedLength < 0)
+            return -1;
+
+          if (receivedLength == 0)
+            return 0;
+
+          host -> receivedData = host -> packetData [0];
+       }
 
-       host -> receivedData = host -> packetData [0];
        host -> receivedDataLength = receivedLength;
       
        host -> totalReceivedData += receivedLength;
@@ -1338,7 +1375,7 @@ enet_protocol_send_acknowledgements (ENetHost * host, ENetPeer * peer)
          enet_protocol_dispatch_state (host, peer, ENET_PEER_STATE_ZOMBIE);
 
        enet_list_remove (& acknowledgement -> acknowledgementList);
-       enet_free (acknowledgement);
+       enet_pool_free (ENET_POOL_ACKNOWLEDGEMENT, acknowledgement);
 
        ++ command;
        ++ buffer;
@@ -1536,7 +1573,7 @@ enet_protocol_check_outgoing_commands (ENetHost * host, ENetPeer * peer, ENetLis
                      enet_packet_destroy (outgoingCommand -> packet);
 
                    enet_list_remove (& outgoingCommand -> outgoingCommandList);
-                   enet_free (outgoingCommand);
+                   enet_pool_free (ENET_POOL_OUTGOING_COMMAND, outgoingCommand);
 
                    if (currentCommand == enet_list_end (& peer -> outgoingCommands))
                      break;
@@ -1577,7 +1614,7 @@ enet_protocol_check_outgoing_commands (ENetHost * host, ENetPeer * peer, ENetLis
        }
        else
        if (! (outgoingCommand -> command.header.command & ENET_PROTOCOL_COMMAND_FLAG_ACKNOWLEDGE))
-         enet_free (outgoingCommand);
+         enet_pool_free (ENET_POOL_OUTGOING_COMMAND, outgoingCommand);
 
        ++ peer -> packetsSent;
         
@@ -1596,6 +1633,62 @@ enet_protocol_check_outgoing_commands (ENetHost * host, ENetPeer * peer, ENetLis
     return canPing;
 }
 
+static int
+enet_protocol_flush_batch (ENetHost * host)
+{
+    size_t sentCount = 0;
+
+    while (sentCount < host -> sendBatchCount)
+    {
+        int result = enet_socket_send_multiple (host -> socket, & host -> sendBatch [sentCount], host -> sendBatchCount - sentCount);
+
+        if (result < 0)
+        {
+            host -> sendBatchCount = 0;
+
+            return -1;
+        }
+
+        /* like a lone send that would block, the rest of the batch is dropped */
+        if (result == 0)
+          break;
+
+        sentCount += result;
+    }
+
+    host -> sendBatchCount = 0;
+
+    return 0;
+}
+
+/* copies the datagram gathered in host -> buffers aside, since the buffers and the unreliable packets they
+   point into are reused or freed before the batch goes out */
+static int
+enet_protocol_queue_datagram (ENetHost * host, const ENetAddress * address)
+{
+    ENetDatagram * datagram;
+    enet_uint8 * data;
+    size_t i;
+
+    if (host -> sendBatchCount >= host -> batchLimit &&
+        enet_protocol_flush_batch (host) < 0)
+      return -1;
+
+    datagram = & host -> sendBatch [host -> sendBatchCount ++];
+    datagram -> address = * address;
+    data = (enet_uint8 *) datagram -> buffer.data;
+
+    for (i = 0; i < host -> bufferCount; ++ i)
+    {
+        memcpy (data, host -> buffers [i].data, host -> buffers [i].dataLength);
+        data += host -> buffers [i].dataLength;
+    }
+
+    datagram -> buffer.dataLength = data - (enet_uint8 *) datagram -> buffer.data;
+
+    return (int) datagram -> buffer.dataLength;
+}
+
 static int
 enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int checkForTimeouts)
 {
@@ -1633,7 +1726,7 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
             enet_protocol_check_timeouts (host, currentPeer, event) == 1)
         {
             if (event != NULL && event -> type != ENET_EVENT_TYPE_NONE)
-              return 1;
+              return host -> sendBatchCount > 0 && enet_protocol_flush_batch (host) < 0 ? -1 : 1;
             else
               goto nextPeer;
         }
@@ -1683,7 +1776,8 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
           host -> buffers -> dataLength = (size_t) & ((ENetProtocolHeader *) 0) -> sentTime;
 
         shouldCompress = 0;
-        if (host -> compressor.context != NULL && host -> compressor.compress != NULL)
+        if (host -> compressor.context != NULL && host -> compressor.compress != NULL &&
+            (currentPeer -> flags & ENET_PEER_FLAG_COMPRESS))
         {
             size_t originalSize = host -> packetSize - sizeof(ENetProtocolHeader),
                    compressedSize = host -> compressor.compress (host -> compressor.context,
@@ -1724,7 +1818,10 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
 
         currentPeer -> lastSendTime = host -> serviceTime;
 
-        sentLength = enet_socket_send (host -> socket, & currentPeer -> address, host -> buffers, host -> bufferCount);
+        if (host -> sendBatch != NULL)
+          sentLength = enet_protocol_queue_datagram (host, & currentPeer -> address);
+        else
+          sentLength = enet_socket_send (host -> socket, & currentPeer -> address, host -> buffers, host -> bufferCount);
 
         enet_protocol_remove_sent_unreliable_commands (currentPeer, & sentUnreliableCommands);
 
@@ -1738,7 +1835,10 @@ enet_protocol_send_outgoing_commands (ENetHost * host, ENetEvent * event, int ch
         if (currentPeer -> flags & ENET_PEER_FLAG_CONTINUE_SENDING)
           continueSending = sendPass + 1;
     }
-   
+
+    if (host -> sendBatchCount > 0)
+      return enet_protocol_flush_batch (host);
+
     return 0;
 }
 
@@ -1897,6 +1997,14 @@ enet_host_service (ENetHost * host, ENetEvent * event, enet_uint32 timeout)
        if (ENET_TIME_GREATER_EQUAL (host -> serviceTime, timeout))
          return 0;
 
+       /* datagrams left over from a batched receive are not seen by the socket, so process them instead of waiting */
+       if (host -> receiveBatchIndex < host -> receiveBatchCount)
+       {
+          host -> serviceTime = enet_time_get ();
+          waitCondition = ENET_SOCKET_WAIT_RECEIVE;
+          continue;
+       }
+
        do
        {
           host -> serviceTime = enet_time_get ();
@@ -4,6 +4,10 @@
 */
 #ifndef _WIN32
 
+#if defined(HAS_MMSG) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -521,6 +525,140 @@ enet_socket_receive (ENetSocket socket,
     return recvLength;
 }
 
+/** Sends each datagram to its address, in as few system calls as the platform allows.
+    @returns the number of datagrams sent, which is less than datagramCount if the socket would block, or -1 on failure
+*/
+int
+enet_socket_send_multiple (ENetSocket socket,
+                           const ENetDatagram * datagrams,
+                           size_t datagramCount)
+{
+#ifdef HAS_MMSG
+    struct mmsghdr msgs [ENET_HOST_MAXIMUM_BATCH];
+    struct sockaddr_in sins [ENET_HOST_MAXIMUM_BATCH];
+    size_t i;
+    int sentCount;
+
+    if (datagramCount > ENET_HOST_MAXIMUM_BATCH)
+      datagramCount = ENET_HOST_MAXIMUM_BATCH;
+
+    memset (msgs, 0, datagramCount * sizeof (struct mmsghdr));
+
+    for (i = 0; i < datagramCount; ++ i)
+    {
+        memset (& sins [i], 0, sizeof (struct sockaddr_in));
+
+        sins [i].sin_family = AF_INET;
+        sins [i].sin_port = ENET_HOST_TO_NET_16 (datagrams [i].address.port);
+        sins [i].sin_addr.s_addr = datagrams [i].address.host;
+
+        msgs [i].msg_hdr.msg_name = & sins [i];
+        msgs [i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+        msgs [i].msg_hdr.msg_iov = (struct iovec *) & datagrams [i].buffer;
+        msgs [i].msg_hdr.msg_iovlen = 1;
+    }
+
+    sentCount = sendmmsg (socket, msgs, datagramCount, MSG_NOSIGNAL);
+
+    if (sentCount == -1)
+    {
+       if (errno == EWOULDBLOCK)
+         return 0;
+
+       return -1;
+    }
+
+    return sentCount;
+#else
+    size_t i;
+
+    for (i = 0; i < datagramCount; ++ i)
+    {
+        int sentLength = enet_socket_send (socket, & datagrams [i].address, & datagrams [i].buffer, 1);
+
+        if (sentLength < 0)
+          return -1;
+
+        if (sentLength == 0)
+          break;
+    }
+
+    return (int) i;
+#endif
+}
+
+/** Receives up to datagramCount datagrams into the buffers given, setting each address and received length.
+    Truncated datagrams are returned with a length of 0.
+    @returns the number of datagrams received, 0 if none are waiting, or -1 on failure
+*/
+int
+enet_socket_receive_multiple (ENetSocket socket,
+                              ENetDatagram * datagrams,
+                              size_t datagramCount)
+{
+#ifdef HAS_MMSG
+    struct mmsghdr msgs [ENET_HOST_MAXIMUM_BATCH];
+    struct sockaddr_in sins [ENET_HOST_MAXIMUM_BATCH];
+    int i, recvCount;
+
+    if (datagramCount > ENET_HOST_MAXIMUM_BATCH)
+      datagramCount = ENET_HOST_MAXIMUM_BATCH;
+
+    memset (msgs, 0, datagramCount * sizeof (struct mmsghdr));
+
+    for (i = 0; i < (int) datagramCount; ++ i)
+    {
+        msgs [i].msg_hdr.msg_name = & sins [i];
+        msgs [i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+        msgs [i].msg_hdr.msg_iov = (struct iovec *) & datagrams [i].buffer;
+        msgs [i].msg_hdr.msg_iovlen = 1;
+    }
+
+    recvCount = recvmmsg (socket, msgs, datagramCount, MSG_NOSIGNAL, NULL);
+
+    if (recvCount == -1)
+    {
+       if (errno == EWOULDBLOCK)
+         return 0;
+
+       return -1;
+    }
+
+    for (i = 0; i < recvCount; ++ i)
+    {
+        datagrams [i].address.host = (enet_uint32) sins [i].sin_addr.s_addr;
+        datagrams [i].address.port = ENET_NET_TO_HOST_16 (sins [i].sin_port);
+
+        if (msgs [i].msg_hdr.msg_flags & MSG_TRUNC)
+          datagrams [i].buffer.dataLength = 0;
+        else
+          datagrams [i].buffer.dataLength = msgs [i].msg_len;
+    }
+
+    return recvCount;
+#else
+    size_t i;
+
+    for (i = 0; i < datagramCount; ++ i)
+    {
+        int recvLength = enet_socket_receive (socket, & datagrams [i].address, & datagrams [i].buffer, 1);
+
+        if (recvLength == -2)
+          recvLength = 0;
+        else
+        if (recvLength < 0)
+          return -1;
+        else
+        if (recvLength == 0)
+          break;
+
+        datagrams [i].buffer.dataLength = recvLength;
+    }
+
+    return (int) i;
+#endif
+}
+
 int
 enet_socketset_select (ENetSocket maxSocket, ENetSocketSet * readSet, ENetSocketSet * writeSet, enet_uint32 timeout)
 {
@@ -401,6 +401,53 @@ enet_socket_receive (ENetSocket socket,
     return (int) recvLength;
 }
 
+int
+enet_socket_send_multiple (ENetSocket socket,
+                           const ENetDatagram * datagrams,
+                           size_t datagramCount)
+{
+    size_t i;
+
+    for (i = 0; i < datagramCount; ++ i)
+    {
+        int sentLength = enet_socket_send (socket, & datagrams [i].address, & datagrams [i].buffer, 1);
+
+        if (sentLength < 0)
+          return -1;
+
+        if (sentLength == 0)
+          break;
+    }
+
+    return (int) i;
+}
+
+int
+enet_socket_receive_multiple (ENetSocket socket,
+                              ENetDatagram * datagrams,
+                              size_t datagramCount)
+{
+    size_t i;
+
+    for (i = 0; i < datagramCount; ++ i)
+    {
+        int recvLength = enet_socket_receive (socket, & datagrams [i].address, & datagrams [i].buffer, 1);
+
+        if (recvLength == -2)
+          recvLength = 0;
+        else
+        if (recvLength < 0)
+          return -1;
+        else
+        if (recvLength == 0)
+          break;
+
+        datagrams [i].buffer.dataLength = recvLength;
+    }
+
+    return (int) i;
+}
+
 int
 enet_socketset_select (ENetSocket maxSocket, ENetSocketSet * readSet, ENetSocketSet * writeSet, enet_uint32 timeout)
 {
@@ -20,6 +20,7 @@ void setrate(int rate)
 }
 
 VARF(rate, 0, 0, 1024, setrate(rate));
+VARP(clientcompress, 0, 1, 1);
 
 void throttle();
 
@@ -115,9 +116,10 @@ void connectserv(const char *servername, int serverport, const char *serverpassw
             return;
         }
         clienthost->duplicatePeers = 0;
+        setupnetcompress(clienthost);
     }
 
-    connpeer = enet_host_connect(clienthost, &address, server::numchannels(), 0);
+    connpeer = enet_host_connect(clienthost, &address, server::numchannels(), clientcompress ? CONNECT_COMPRESS : 0);
     enet_host_flush(clienthost);
     connmillis = totalmillis;
     connattempts = 0;
@@ -7,8 +7,13 @@
 #endif
 
 #include "cube.h"
+#include "thread.h"
 #include <signal.h>
 #include <enet/time.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#define HAS_EPOLL
+#endif
 
 #define INPUT_LIMIT 4096
 #define OUTPUT_LIMIT (64*1024)
@@ -16,13 +21,19 @@
 #define AUTH_TIME (30*1000)
 #define AUTH_LIMIT 100
 #define AUTH_THROTTLE 1000
+#define AUTH_THREADS 16
 #define CLIENT_LIMIT 4096
+#define POLL_CLIENT_LIMIT 65536
+#define POLL_EVENTS 256
+#define TIMER_TICK 1000
+#define TIMER_SLOTS 256
 #define DUP_LIMIT 16
 #define PING_TIME 3000
 #define PING_RETRY 5
 #define KEEPALIVE_TIME (65*60*1000)
 #define SERVER_LIMIT 4096
 #define SERVER_DUP_LIMIT 10
+#define SERVER_SLOT 32
 
 FILE *logfile = NULL;
 
@@ -49,30 +60,27 @@ void clearusers()
 }
 COMMAND(clearusers, "");
 
-vector<ipmask> bans, servbans, gbans;
+ipmaskset bans, servbans, gbans;
 
 void clearbans()
 {
-    bans.shrink(0);
-    servbans.shrink(0);
-    gbans.shrink(0);
+    bans.clear();
+    servbans.clear();
+    gbans.clear();
 }
 COMMAND(clearbans, "");
 
-void addban(vector<ipmask> &bans, const char *name)
+void addban(ipmaskset &bans, const char *name)
 {
-    ipmask ban;
-    ban.parse(name);
-    bans.add(ban);
+    bans.add(name);
 }
 ICOMMAND(ban, "s", (char *name), addban(bans, name));
 ICOMMAND(servban, "s", (char *name), addban(servbans, name));
 ICOMMAND(gban, "s", (char *name), addban(gbans, name));
 
-bool checkban(vector<ipmask> &bans, enet_uint32 host)
+bool checkban(ipmaskset &bans, enet_uint32 host)
 {
-    loopv(bans) if(bans[i].check(host)) return true;
-    return false;
+    return bans.check(host);
 }
 
 struct authreq
@@ -86,11 +94,69 @@ struct gameserver
 {
     ENetAddress address;
     string ip;
-    int port, numpings;
+    int port, numpings, slot;
     enet_uint32 lastping, lastpong;
 };
 vector<gameserver *> gameservers;
 
+// the serialized list kept as the motd followed by one fixed-width line per answering server,
+// so servers coming and going patch a single slot instead of regenerating the whole text
+struct serverlist
+{
+    vector<char> buf;
+    vector<gameserver *> listed;
+    int header;
+    uint generation, published;
+
+    serverlist() : header(0), generation(1), published(0) {}
+
+    void setheader(const char *motd)
+    {
+        vector<char> text;
+        if(motd[0])
+        {
+            const char *cmd = "notice ";
+            text.put(cmd, strlen(cmd));
+            text.put(motd, strlen(motd));
+            text.add('\n');
+        }
+        buf.remove(0, header);
+        buf.insert(0, text.getbuf(), text.length());
+        header = text.length();
+        generation++;
+    }
+
+    void add(gameserver &s)
+    {
+        if(s.slot >= 0) return;
+        s.slot = listed.length();
+        listed.add(&s);
+        defformatstring(line, "addserver %s %d", s.ip, s.port);
+        int len = min(int(strlen(line)), SERVER_SLOT-1);
+        char *dst = buf.pad(SERVER_SLOT);
+        memcpy(dst, line, len);
+        memset(&dst[len], ' ', SERVER_SLOT-1 - len);
+        dst[SERVER_SLOT-1] = '\n';
+        generation++;
+    }
+
+    void remove(gameserver &s)
+    {
+        if(s.slot < 0) return;
+        gameserver *last = listed.pop();
+        if(last != &s)
+        {
+            memcpy(&buf[header + s.slot*SERVER_SLOT], &buf[header + last->slot*SERVER_SLOT], SERVER_SLOT);
+            listed[s.slot] = last;
+            last->slot = s.slot;
+        }
+        buf.setsize(buf.length() - SERVER_SLOT);
+        s.slot = -1;
+        generation++;
+    }
+};
+serverlist servlist;
+
 struct messagebuf
 {
     vector<messagebuf *> &owner;
@@ -120,7 +186,6 @@ struct messagebuf
     }
 };
 vector<messagebuf *> gameserverlists, gbanlists;
-bool updateserverlist = true;
 
 struct client
 {
@@ -136,11 +201,77 @@ struct client
     vector<authreq> authreqs;
     bool shouldpurge;
     bool registeredserver;
-
-    client() : message(NULL), inputpos(0), outputpos(0), servport(-1), lastauth(0), shouldpurge(false), registeredserver(false) {}
+    int index;
+    bool canread, canwrite, hangup, queued;
+    client *timernext, *timerprev;
+    int timerslot;
+    int authjobs;
+    bool purged;
+
+    client() : message(NULL), inputpos(0), outputpos(0), servport(-1), lastauth(0), shouldpurge(false), registeredserver(false), index(-1),
+        canread(false), canwrite(false), hangup(false), queued(false), timernext(NULL), timerprev(NULL), timerslot(-1), authjobs(0), purged(false) {}
 };
 vector<client *> clients;
 
+// coarse timer wheel holding every client in the slot of its next deadline, so idle clients cost nothing until one comes up
+struct timerwheel
+{
+    client *slots[TIMER_SLOTS];
+    enet_uint32 lasttick;
+
+    timerwheel() : lasttick(0) { memset(slots, 0, sizeof(slots)); }
+
+    void cancel(client &c)
+    {
+        if(c.timerslot < 0) return;
+        if(c.timerprev) c.timerprev->timernext = c.timernext;
+        else slots[c.timerslot] = c.timernext;
+        if(c.timernext) c.timernext->timerprev = c.timerprev;
+        c.timernext = c.timerprev = NULL;
+        c.timerslot = -1;
+    }
+
+    // deadlines beyond the span of the wheel come up early and are simply scheduled again
+    void schedule(client &c, enet_uint32 now, enet_uint32 deadline)
+    {
+        cancel(c);
+        enet_uint32 ticks = ENET_TIME_LESS(now, deadline) ? (deadline - now + TIMER_TICK - 1)/TIMER_TICK : 1;
+        c.timerslot = (lasttick + clamp(ticks, 1U, enet_uint32(TIMER_SLOTS-1)))%TIMER_SLOTS;
+        c.timernext = slots[c.timerslot];
+        if(c.timernext) c.timernext->timerprev = &c;
+        slots[c.timerslot] = &c;
+    }
+
+    void advance(enet_uint32 now, vector<client *> &expired)
+    {
+        enet_uint32 tick = now/TIMER_TICK, steps = min(tick - lasttick, enet_uint32(TIMER_SLOTS));
+        loopi(steps)
+        {
+            client *&slot = slots[(lasttick + i + 1)%TIMER_SLOTS];
+            for(client *c = slot; c; c = c->timernext)
+            {
+                c->timerslot = -1;
+                expired.add(c);
+            }
+            slot = NULL;
+        }
+        loopv(expired) expired[i]->timernext = expired[i]->timerprev = NULL;
+        lasttick = tick;
+    }
+};
+timerwheel timers;
+
+// with epoll, sockets are edge-triggered and clients with something to do wait in a queue; otherwise every client is selected on
+int epollfd = -1;
+vector<client *> pendingclients;
+
+void wakeclient(client &c)
+{
+    if(epollfd < 0 || c.queued) return;
+    c.queued = true;
+    pendingclients.add(&c);
+}
+
 ENetSocket serversocket = ENET_SOCKET_NULL;
 
 time_t starttime;
@@ -166,15 +297,24 @@ void purgeclient(int n)
 {
     client &c = *clients[n];
     if(c.message) c.message->purge();
+    timers.cancel(c);
+    if(c.queued) pendingclients.removeobj(&c);
     enet_socket_destroy(c.socket);
-    delete clients[n];
-    clients.remove(n);
+    c.socket = ENET_SOCKET_NULL;
+    loopv(c.authreqs) freechallenge(c.authreqs[i].answer);
+    c.authreqs.setsize(0);
+    // challenges still being generated hold on to the client until they come back
+    if(c.authjobs > 0) c.purged = true;
+    else delete clients[n];
+    clients.removeunordered(n);
+    if(clients.inrange(n)) clients[n]->index = n;
 }
 
 void output(client &c, const char *msg, int len = 0)
 {
     if(!len) len = strlen(msg);
     c.output.put(msg, len);
+    wakeclient(c);
 }
 
 void outputf(client &c, const char *fmt, ...)
@@ -196,6 +336,163 @@ bool setuppingsocket(ENetAddress *address)
     return true;
 }
 
+// challenges are generated on worker threads so that a burst of auth requests does not stall list requests and pings,
+// with finished jobs handed back through a loopback datagram that wakes the main loop
+struct authjob
+{
+    client *c;
+    uint id;
+    void *pubkey;
+    uint seed[3];
+    void *answer;
+    vector<char> challenge;
+};
+
+struct authworkers
+{
+    threadhandle threads[AUTH_THREADS];
+    int numthreads, pending;
+    mutex lock;
+    semaphore wakeup;
+    vector<authjob *> queued, done;
+    ENetSocket notify;
+    ENetAddress notifyaddress;
+
+    authworkers() : numthreads(0), pending(0), notify(ENET_SOCKET_NULL) {}
+
+    bool setup()
+    {
+        if(notify != ENET_SOCKET_NULL) return true;
+        notify = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+        if(notify == ENET_SOCKET_NULL) return false;
+        notifyaddress.host = ENET_HOST_TO_NET_32(0x7F000001);
+        notifyaddress.port = 0;
+        if(enet_socket_bind(notify, &notifyaddress) < 0 || enet_socket_get_address(notify, &notifyaddress) < 0 ||
+           enet_socket_set_option(notify, ENET_SOCKOPT_NONBLOCK, 1) < 0)
+        {
+            enet_socket_destroy(notify);
+            notify = ENET_SOCKET_NULL;
+            return false;
+        }
+        return true;
+    }
+
+    static int work(void *data)
+    {
+        authworkers &w = *(authworkers *)data;
+        ENetSocket sock = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+        for(;;)
+        {
+            w.wakeup.wait();
+            w.lock.lock();
+            authjob *job = w.queued.length() ? w.queued.remove(0) : NULL;
+            w.lock.unlock();
+            if(!job) break;
+
+            job->answer = genchallenge(job->pubkey, job->seed, sizeof(job->seed), job->challenge);
+
+            w.lock.lock();
+            bool wake = w.done.empty();
+            w.done.add(job);
+            w.lock.unlock();
+            if(wake && sock != ENET_SOCKET_NULL)
+            {
+                static const uchar msg = 0;
+                ENetBuffer buf;
+                buf.data = (void *)&msg;
+                buf.dataLength = 1;
+                enet_socket_send(sock, &w.notifyaddress, &buf, 1);
+            }
+        }
+        if(sock != ENET_SOCKET_NULL) enet_socket_destroy(sock);
+        return 0;
+    }
+
+    bool running() const { return numthreads > 0; }
+
+    void start(int n)
+    {
+        if(notify == ENET_SOCKET_NULL) return;
+        // the hash tables are built on first use, so do that before any worker can race for it
+        string hash;
+        hashstring("", hash, sizeof(hash));
+        for(numthreads = 0; numthreads < n; numthreads++) if(!threads[numthreads].start(work, this)) break;
+    }
+
+    void add(authjob *job)
+    {
+        pending++;
+        job->c->authjobs++;
+        lock.lock();
+        queued.add(job);
+        lock.unlock();
+        wakeup.post();
+    }
+
+    void finish(authjob *job)
+    {
+        pending--;
+        client &c = *job->c;
+        c.authjobs--;
+        authreq *a = NULL;
+        if(!c.purged) loopv(c.authreqs) if(c.authreqs[i].id == job->id && !c.authreqs[i].answer) { a = &c.authreqs[i]; break; }
+        if(a)
+        {
+            a->answer = job->answer;
+            outputf(c, "chalauth %u %s\n", job->id, job->challenge.getbuf());
+        }
+        else freechallenge(job->answer);
+        if(c.purged && c.authjobs <= 0) delete &c;
+        delete job;
+    }
+
+    void check()
+    {
+        static uchar buf[64];
+        ENetBuffer data;
+        data.data = buf;
+        data.dataLength = sizeof(buf);
+        while(enet_socket_receive(notify, NULL, &data, 1) > 0);
+
+        static vector<authjob *> finished;
+        lock.lock();
+        finished.put(done.getbuf(), done.length());
+        done.setsize(0);
+        lock.unlock();
+        loopv(finished) finish(finished[i]);
+        finished.setsize(0);
+    }
+
+    // waits out every outstanding job, so that user keys can be replaced under them
+    void flush()
+    {
+        while(pending > 0)
+        {
+            enet_uint32 cond = ENET_SOCKET_WAIT_RECEIVE;
+            enet_socket_wait(notify, &cond, 100);
+            check();
+        }
+    }
+
+    void stop()
+    {
+        flush();
+        loopi(numthreads) wakeup.post();
+        loopi(numthreads) threads[i].join();
+        numthreads = 0;
+    }
+};
+authworkers authpool;
+
+void setupauthworkers();
+VARF(auththreads, 0, 2, AUTH_THREADS, setupauthworkers());
+
+void setupauthworkers()
+{
+    authpool.stop();
+    if(auththreads > 0) authpool.start(auththreads);
+}
+
 void setupserver(int port, const char *ip = NULL)
 {
     ENetAddress address;
@@ -217,6 +514,8 @@ void setupserver(int port, const char *ip = NULL)
         fatal("failed to make server socket non-blocking");
     if(!setuppingsocket(&address))
         fatal("failed to create ping socket");
+    if(!authpool.setup())
+        conoutf("failed to create auth notification socket, generating challenges on the main thread");
 
     enet_time_set(0);
 
@@ -226,31 +525,29 @@ void setupserver(int port, const char *ip = NULL)
     conoutf("*** Starting master server on %s %d at %s ***", ip ? ip : "localhost", port, ct);
 }
 
-SVAR(mastermotd, "");
+SVARF(mastermotd, "", servlist.setheader(mastermotd));
 
-void genserverlist()
+// hands out the current list, only copying it into a fresh snapshot when it changed since the last one was published
+messagebuf *getserverlist()
 {
-    if(!updateserverlist) return;
-    while(gameserverlists.length() && gameserverlists.last()->refs<=0)
-        delete gameserverlists.pop();
-    messagebuf *l = new messagebuf(gameserverlists);
-    if(mastermotd[0])
-    {
-        const char *cmd = "notice ";
-        l->buf.put(cmd, strlen(cmd));
-        l->buf.put(mastermotd, strlen(mastermotd));
-        l->buf.add('\n');
-    }
-    loopv(gameservers)
+    if(servlist.published != servlist.generation || gameserverlists.empty())
     {
-        gameserver &s = *gameservers[i];
-        if(!s.lastpong) continue;
-        defformatstring(cmd, "addserver %s %d\n", s.ip, s.port);
-        l->buf.put(cmd, strlen(cmd));
+        while(gameserverlists.length() && gameserverlists.last()->refs<=0)
+            delete gameserverlists.pop();
+        messagebuf *l = new messagebuf(gameserverlists);
+        l->buf.put(servlist.buf.getbuf(), servlist.buf.length());
+        l->buf.add('\0');
+        gameserverlists.add(l);
+        servlist.published = servlist.generation;
     }
-    l->buf.add('\0');
-    gameserverlists.add(l);
-    updateserverlist = false;
+    return gameserverlists.last();
+}
+
+void removegameserver(int i)
+{
+    gameserver *s = gameservers.remove(i);
+    servlist.remove(*s);
+    delete s;
 }
 
 void gengbanlist()
@@ -262,7 +559,7 @@ void gengbanlist()
     int cmdlen = strlen(cmd);
     loopv(gbans)
     {
-        ipmask &b = gbans[i];
+        const ipmask &b = gbans[i];
         l->buf.put(cmd, cmdlen + b.print(&cmd[cmdlen]));
         l->buf.add('\n');
     }
@@ -286,6 +583,7 @@ void gengbanlist()
         {
             c.message = l;
             c.message->refs++;
+            wakeclient(c);
         }
     }
 }
@@ -323,6 +621,7 @@ void addgameserver(client &c)
     copystring(s.ip, hostname);
     s.port = c.servport;
     s.numpings = 0;
+    s.slot = -1;
     s.lastping = s.lastpong = 0;
 }
 
@@ -373,7 +672,7 @@ void checkserverpongs()
                         }
                     }
                 }
-                if(!s.lastpong) updateserverlist = true;
+                if(!s.lastpong) servlist.add(s);
                 s.lastpong = servtime ? servtime : 1;
                 break;
             }
@@ -383,11 +682,7 @@ void checkserverpongs()
 
 void bangameservers()
 {
-    loopvrev(gameservers) if(checkban(servbans, gameservers[i]->address.host))
-    {
-        delete gameservers.remove(i);
-        updateserverlist = true;
-    }
+    loopvrev(gameservers) if(checkban(servbans, gameservers[i]->address.host)) removegameserver(i);
 }
 
 void checkgameservers()
@@ -399,18 +694,14 @@ void checkgameservers()
         if(s.lastping && s.lastpong && ENET_TIME_LESS_EQUAL(s.lastping, s.lastpong))
         {
             if(ENET_TIME_DIFFERENCE(servtime, s.lastpong) > KEEPALIVE_TIME)
-            {
-                delete gameservers.remove(i--);
-                updateserverlist = true;
-            }
+                removegameserver(i--);
         }
         else if(!s.lastping || ENET_TIME_DIFFERENCE(servtime, s.lastping) > PING_TIME)
         {
             if(s.numpings >= PING_RETRY)
             {
                 servermessage(s, "failreg failed pinging server\n");
-                delete gameservers.remove(i--);
-                updateserverlist = true;
+                removegameserver(i--);
             }
             else
             {
@@ -435,6 +726,14 @@ void messagebuf::purge()
     }
 }
 
+// the earliest of the client going idle and its oldest auth request running out
+void scheduleclient(client &c)
+{
+    enet_uint32 deadline = c.lastinput + (c.registeredserver ? KEEPALIVE_TIME : CLIENT_TIME);
+    if(c.authreqs.length() && ENET_TIME_LESS(c.authreqs[0].reqtime + AUTH_TIME, deadline)) deadline = c.authreqs[0].reqtime + AUTH_TIME;
+    timers.schedule(c, servtime, deadline);
+}
+
 void purgeauths(client &c)
 {
     int expired = 0;
@@ -488,7 +787,20 @@ void reqauth(client &c, uint id, char *name)
     authreq &a = c.authreqs.add();
     a.reqtime = servtime;
     a.id = id;
+    a.answer = NULL;
+    if(c.authreqs.length() == 1) scheduleclient(c);
     uint seed[3] = { uint(starttime), servtime, randomMT() };
+    if(authpool.running())
+    {
+        authjob *job = new authjob;
+        job->c = &c;
+        job->id = id;
+        job->pubkey = u->pubkey;
+        memcpy(job->seed, seed, sizeof(seed));
+        job->answer = NULL;
+        authpool.add(job);
+        return;
+    }
     static vector<char> buf;
     buf.setsize(0);
     a.answer = genchallenge(u->pubkey, seed, sizeof(seed), buf);
@@ -504,7 +816,7 @@ void confauth(client &c, uint id, const char *val)
     {
         string ip;
         if(enet_address_get_host_ip(&c.address, ip, sizeof(ip)) < 0) copystring(ip, "-");
-        if(checkchallenge(val, c.authreqs[i].answer))
+        if(c.authreqs[i].answer && checkchallenge(val, c.authreqs[i].answer))
         {
             outputf(c, "succauth %u\n", id);
             conoutf("succeeded %u from %s", id, ip);
@@ -535,9 +847,8 @@ bool checkclientinput(client &c)
         string user, val;
         if(!strncmp(c.input, "list", 4) && (!c.input[4] || c.input[4] == '\n' || c.input[4] == '\r'))
         {
-            genserverlist();
-            if(gameserverlists.empty() || c.message) return false;
-            c.message = gameserverlists.last();
+            if(c.message) return false;
+            c.message = getserverlist();
             c.message->refs++;
             c.output.setsize(0);
             c.outputpos = 0;
@@ -570,100 +881,206 @@ bool checkclientinput(client &c)
     return c.inputpos<(int)sizeof(c.input);
 }
 
-ENetSocketSet readset, writeset;
+int clientlimit()
+{
+    return epollfd >= 0 ? POLL_CLIENT_LIMIT : CLIENT_LIMIT;
+}
 
-void checkclients()
+#ifdef HAS_EPOLL
+bool pollsocket(ENetSocket sock, void *data)
 {
-    ENetSocketSet readset, writeset;
-    ENetSocket maxsock = max(serversocket, pingsocket);
-    ENET_SOCKETSET_EMPTY(readset);
-    ENET_SOCKETSET_EMPTY(writeset);
-    ENET_SOCKETSET_ADD(readset, serversocket);
-    ENET_SOCKETSET_ADD(readset, pingsocket);
-    loopv(clients)
+    epoll_event e;
+    e.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    e.data.ptr = data;
+    return epoll_ctl(epollfd, EPOLL_CTL_ADD, sock, &e) >= 0;
+}
+#endif
+
+void setuppoll()
+{
+#ifdef HAS_EPOLL
+    epollfd = epoll_create1(0);
+    if(epollfd >= 0 && (!pollsocket(serversocket, &serversocket) || !pollsocket(pingsocket, &pingsocket) ||
+                        (authpool.notify != ENET_SOCKET_NULL && !pollsocket(authpool.notify, &authpool))))
     {
-        client &c = *clients[i];
-        if(c.authreqs.length()) purgeauths(c);
-        if(c.message || c.output.length()) ENET_SOCKETSET_ADD(writeset, c.socket);
-        else ENET_SOCKETSET_ADD(readset, c.socket);
-        maxsock = max(maxsock, c.socket);
+        close(epollfd);
+        epollfd = -1;
     }
-    if(enet_socketset_select(maxsock, &readset, &writeset, 1000)<=0) return;
+#endif
+    conoutf("waiting on clients with %s", epollfd >= 0 ? "epoll" : "select");
+}
 
-    if(ENET_SOCKETSET_CHECK(readset, pingsocket)) checkserverpongs();
-    if(ENET_SOCKETSET_CHECK(readset, serversocket))
+void acceptclients()
+{
+    for(;;)
     {
         ENetAddress address;
         ENetSocket clientsocket = enet_socket_accept(serversocket, &address);
-        if(clients.length()>=CLIENT_LIMIT || checkban(bans, address.host)) enet_socket_destroy(clientsocket);
-        else if(clientsocket!=ENET_SOCKET_NULL)
+        if(clientsocket==ENET_SOCKET_NULL) break;
+        if(clients.length()>=clientlimit() || checkban(bans, address.host)) { enet_socket_destroy(clientsocket); continue; }
+
+        int dups = 0, oldest = -1;
+        loopv(clients) if(clients[i]->address.host == address.host)
         {
-            int dups = 0, oldest = -1;
-            loopv(clients) if(clients[i]->address.host == address.host)
-            {
-                dups++;
-                if(oldest<0 || clients[i]->connecttime < clients[oldest]->connecttime) oldest = i;
-            }
-            if(dups >= DUP_LIMIT) purgeclient(oldest);
-
-            client *c = new client;
-            c->address = address;
-            c->socket = clientsocket;
-            c->connecttime = servtime;
-            c->lastinput = servtime;
-            clients.add(c);
+            dups++;
+            if(oldest<0 || clients[i]->connecttime < clients[oldest]->connecttime) oldest = i;
         }
+        if(dups >= DUP_LIMIT) purgeclient(oldest);
+
+        client *c = new client;
+        c->address = address;
+        c->socket = clientsocket;
+        c->connecttime = servtime;
+        c->lastinput = servtime;
+        c->index = clients.length();
+        clients.add(c);
+        scheduleclient(*c);
+#ifdef HAS_EPOLL
+        if(epollfd >= 0 && (enet_socket_set_option(clientsocket, ENET_SOCKOPT_NONBLOCK, 1) < 0 || !pollsocket(clientsocket, c))) purgeclient(c->index);
+#endif
     }
+}
 
-    loopv(clients)
+// moves as much data as the socket is ready for, returning false once the client should be purged
+bool serviceclient(client &c)
+{
+    for(;;)
     {
-        client &c = *clients[i];
-        if((c.message || c.output.length()) && ENET_SOCKETSET_CHECK(writeset, c.socket))
+        if(c.message || c.output.length())
         {
+            if(!c.canwrite) break;
             const char *data = c.output.length() ? c.output.getbuf() : c.message->getbuf();
             int len = c.output.length() ? c.output.length() : c.message->length();
             ENetBuffer buf;
             buf.data = (void *)&data[c.outputpos];
             buf.dataLength = len-c.outputpos;
             int res = enet_socket_send(c.socket, NULL, &buf, 1);
-            if(res>=0)
+            if(res<0) return false;
+            c.outputpos += res;
+            // select only promised that one send would not block, blocking sockets may stall on a second
+            if(epollfd < 0) c.canwrite = false;
+            if(c.outputpos<len) { c.canwrite = false; break; }
+            if(c.output.length()) c.output.setsize(0);
+            else
             {
-                c.outputpos += res;
-                if(c.outputpos>=len)
-                {
-                    if(c.output.length()) c.output.setsize(0);
-                    else
-                    {
-                        c.message->purge();
-                        c.message = NULL;
-                    }
-                    c.outputpos = 0;
-                    if(!c.message && c.output.empty() && c.shouldpurge)
-                    {
-                        purgeclient(i--);
-                        continue;
-                    }
-                }
+                c.message->purge();
+                c.message = NULL;
             }
-            else { purgeclient(i--); continue; }
+            c.outputpos = 0;
+            if(!c.message && c.output.empty() && c.shouldpurge) return false;
         }
-        if(ENET_SOCKETSET_CHECK(readset, c.socket))
+        else
         {
+            if(!c.canread) break;
             ENetBuffer buf;
             buf.data = &c.input[c.inputpos];
             buf.dataLength = sizeof(c.input) - c.inputpos;
             int res = enet_socket_receive(c.socket, NULL, &buf, 1);
-            if(res>0)
-            {
-                c.inputpos += res;
-                c.input[min(c.inputpos, (int)sizeof(c.input)-1)] = '\0';
-                if(!checkclientinput(c)) { purgeclient(i--); continue; }
-            }
-            else { purgeclient(i--); continue; }
+            // edge-triggered sockets are read until they would block, which only means the end of input once the peer hung up
+            if(epollfd >= 0 && !res && !c.hangup) { c.canread = false; break; }
+            if(res<=0) return false;
+            if(epollfd < 0) c.canread = false;
+            c.inputpos += res;
+            c.input[min(c.inputpos, (int)sizeof(c.input)-1)] = '\0';
+            if(!checkclientinput(c)) return false;
+        }
+    }
+    return c.output.length() <= OUTPUT_LIMIT;
+}
+
+void selectclients()
+{
+    ENetSocketSet readset, writeset;
+    ENetSocket maxsock = max(serversocket, pingsocket);
+    ENET_SOCKETSET_EMPTY(readset);
+    ENET_SOCKETSET_EMPTY(writeset);
+    ENET_SOCKETSET_ADD(readset, serversocket);
+    ENET_SOCKETSET_ADD(readset, pingsocket);
+    if(authpool.notify != ENET_SOCKET_NULL)
+    {
+        ENET_SOCKETSET_ADD(readset, authpool.notify);
+        maxsock = max(maxsock, authpool.notify);
+    }
+    loopv(clients)
+    {
+        client &c = *clients[i];
+        if(c.message || c.output.length()) ENET_SOCKETSET_ADD(writeset, c.socket);
+        else ENET_SOCKETSET_ADD(readset, c.socket);
+        maxsock = max(maxsock, c.socket);
+    }
+    if(enet_socketset_select(maxsock, &readset, &writeset, 1000)<=0) return;
+    servtime = enet_time_get();
+
+    loopv(clients)
+    {
+        client &c = *clients[i];
+        c.canread = ENET_SOCKETSET_CHECK(readset, c.socket);
+        c.canwrite = ENET_SOCKETSET_CHECK(writeset, c.socket);
+    }
+    if(ENET_SOCKETSET_CHECK(readset, pingsocket)) checkserverpongs();
+    if(ENET_SOCKETSET_CHECK(readset, serversocket)) acceptclients();
+    if(authpool.notify != ENET_SOCKET_NULL && ENET_SOCKETSET_CHECK(readset, authpool.notify)) authpool.check();
+
+    loopv(clients) if(!serviceclient(*clients[i])) purgeclient(i--);
+}
+
+#ifdef HAS_EPOLL
+void pollclients()
+{
+    static epoll_event events[POLL_EVENTS];
+    int numevents = epoll_wait(epollfd, events, POLL_EVENTS, pendingclients.length() ? 0 : 1000);
+    servtime = enet_time_get();
+    bool accept = false, pong = false, auth = false;
+    loopi(numevents)
+    {
+        epoll_event &e = events[i];
+        if(e.data.ptr == &serversocket) accept = true;
+        else if(e.data.ptr == &pingsocket) pong = true;
+        else if(e.data.ptr == &authpool) auth = true;
+        else
+        {
+            client &c = *(client *)e.data.ptr;
+            if(e.events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) c.hangup = c.canread = c.canwrite = true;
+            if(e.events & EPOLLIN) c.canread = true;
+            if(e.events & EPOLLOUT) c.canwrite = true;
+            wakeclient(c);
         }
-        if(c.output.length() > OUTPUT_LIMIT) { purgeclient(i--); continue; }
-        if(ENET_TIME_DIFFERENCE(servtime, c.lastinput) >= (c.registeredserver ? KEEPALIVE_TIME : CLIENT_TIME)) { purgeclient(i--); continue; }
     }
+    if(pong) checkserverpongs();
+    if(accept) acceptclients();
+    if(auth) authpool.check();
+
+    while(pendingclients.length())
+    {
+        client &c = *pendingclients.pop();
+        c.queued = false;
+        if(!serviceclient(c)) purgeclient(c.index);
+    }
+}
+#endif
+
+void checktimers()
+{
+    static vector<client *> expired;
+    expired.setsize(0);
+    timers.advance(servtime, expired);
+    loopv(expired)
+    {
+        client &c = *expired[i];
+        if(c.authreqs.length()) purgeauths(c);
+        if(ENET_TIME_DIFFERENCE(servtime, c.lastinput) >= (c.registeredserver ? KEEPALIVE_TIME : CLIENT_TIME)) purgeclient(c.index);
+        else scheduleclient(c);
+    }
+}
+
+void checkclients()
+{
+#ifdef HAS_EPOLL
+    if(epollfd >= 0) pollclients();
+    else
+#endif
+    selectclients();
+    checktimers();
 }
 
 void banclients()
@@ -701,11 +1118,14 @@ int main(int argc, char **argv)
     signal(SIGUSR1, reloadsignal);
 #endif
     setupserver(port, ip);
+    setuppoll();
+    setupauthworkers();
     for(;;)
     {
         if(reloadcfg)
         {
             conoutf("reloading %s", cfgname);
+            authpool.flush();
             execfile(cfgname);
             bangameservers();
             banclients();
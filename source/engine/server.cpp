@@ -6,6 +6,7 @@
 #define LOGSTRLEN 512
 
 static FILE *logfile = NULL;
+static string logprefix = "";
 
 void closelogfile()
 {
@@ -61,7 +62,9 @@ static void writelog(FILE *file, const char *buf)
 static void writelogv(FILE *file, const char *fmt, va_list args)
 {
     static char buf[LOGSTRLEN];
-    vformatstring(buf, fmt, args, sizeof(buf));
+    int prefixlen = min(int(strlen(logprefix)), LOGSTRLEN-1);
+    memcpy(buf, logprefix, prefixlen);
+    vformatstring(&buf[prefixlen], fmt, args, sizeof(buf) - prefixlen);
     writelog(file, buf);
 }
 
@@ -89,7 +92,7 @@ void conoutfv(int type, const char *fmt, va_list args)
 
 #define DEFAULTCLIENTS 8
 
-enum { ST_EMPTY, ST_LOCAL, ST_TCPIP };
+enum { ST_EMPTY, ST_LOCAL, ST_TCPIP, ST_VIRTUAL };
 
 struct client                   // server side version of "dynent" type
 {
@@ -129,7 +132,7 @@ client &addclient(int type)
     c->type = type;
     switch(type)
     {
-        case ST_TCPIP: nonlocalclients++; break;
+        case ST_TCPIP: case ST_VIRTUAL: nonlocalclients++; break;
         case ST_LOCAL: localclients++; break;
     }
     return *c;
@@ -141,6 +144,7 @@ void delclient(client *c)
     switch(c->type)
     {
         case ST_TCPIP: nonlocalclients--; if(c->peer) c->peer->data = NULL; break;
+        case ST_VIRTUAL: nonlocalclients--; break;
         case ST_LOCAL: localclients--; break;
         case ST_EMPTY: return;
     }
@@ -153,6 +157,27 @@ void delclient(client *c)
     }
 }
 
+// per channel traffic, reported by the metrics endpoint
+#define METRICSCHANNELS 4
+
+void cleanupmetrics();
+
+ullong metricsendbytes[METRICSCHANNELS], metricsendpackets[METRICSCHANNELS], metricrecvbytes[METRICSCHANNELS], metricrecvpackets[METRICSCHANNELS];
+
+static inline void countsend(int chan, int len)
+{
+    chan = clamp(chan, 0, METRICSCHANNELS-1);
+    metricsendbytes[chan] += len;
+    metricsendpackets[chan]++;
+}
+
+static inline void countrecv(int chan, int len)
+{
+    chan = clamp(chan, 0, METRICSCHANNELS-1);
+    metricrecvbytes[chan] += len;
+    metricrecvpackets[chan]++;
+}
+
 void cleanupserver()
 {
     if(serverhost) enet_host_destroy(serverhost);
@@ -160,6 +185,8 @@ void cleanupserver()
 
     if(lansock != ENET_SOCKET_NULL) enet_socket_destroy(lansock);
     lansock = ENET_SOCKET_NULL;
+
+    cleanupmetrics();
 }
 
 VARF(maxclients, 0, DEFAULTCLIENTS, MAXCLIENTS, { if(!maxclients) maxclients = DEFAULTCLIENTS; });
@@ -173,6 +200,9 @@ ENetPeer *getclientpeer(int i) { return clients.inrange(i) && clients[i]->type==
 int getnumclients()        { return clients.length(); }
 uint getclientip(int n)    { return clients.inrange(n) && clients[n]->type==ST_TCPIP ? clients[n]->peer->address.host : 0; }
 
+// packets sent to virtual clients, held until the driving benchmark releases them as a peer would once delivered
+vector<ENetPacket *> virtualpackets;
+
 void sendpacket(int n, int chan, ENetPacket *packet, int exclude)
 {
     if(n<0)
@@ -186,9 +216,15 @@ void sendpacket(int n, int chan, ENetPacket *packet, int exclude)
         case ST_TCPIP:
         {
             enet_peer_send(clients[n]->peer, chan, packet);
+            countsend(chan, packet->dataLength);
             break;
         }
 
+        case ST_VIRTUAL:
+            packet->referenceCount++;
+            virtualpackets.add(packet);
+            break;
+
 #ifndef STANDALONE
         case ST_LOCAL:
             localservertoclient(chan, packet);
@@ -197,14 +233,10 @@ void sendpacket(int n, int chan, ENetPacket *packet, int exclude)
     }
 }
 
-ENetPacket *sendf(int cn, int chan, const char *format, ...)
+// writes the fields of a sendf format into p, returning the client an 'x' excludes
+static int putformat(packetbuf &p, const char *format, va_list args)
 {
     int exclude = -1;
-    bool reliable = false;
-    if(*format=='r') { reliable = true; ++format; }
-    packetbuf p(MAXTRANS, reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
-    va_list args;
-    va_start(args, format);
     while(*format) switch(*format++)
     {
         case 'x':
@@ -239,12 +271,89 @@ ENetPacket *sendf(int cn, int chan, const char *format, ...)
             break;
         }
     }
+    return exclude;
+}
+
+ENetPacket *sendf(int cn, int chan, const char *format, ...)
+{
+    bool reliable = false;
+    if(*format=='r') { reliable = true; ++format; }
+    packetbuf p(MAXTRANS, reliable ? ENET_PACKET_FLAG_RELIABLE : 0);
+    va_list args;
+    va_start(args, format);
+    int exclude = putformat(p, format, args);
     va_end(args);
     ENetPacket *packet = p.finalize();
     sendpacket(cn, chan, packet, exclude);
     return packet->referenceCount > 0 ? packet : NULL;
 }
 
+#define MAXPOOLEDMSGPACKETS 4096
+
+// fixed size blocks that typed messages are written into, handed back when ENet frees the packet
+static vector<uchar *> msgpackets;
+static int msgpacketallocs = 0;
+
+static void freemsgpacket(ENetPacket *packet)
+{
+    if(msgpackets.length() < MAXPOOLEDMSGPACKETS) msgpackets.add(packet->data);
+    else delete[] packet->data;
+}
+
+ENetPacket *newmsgpacket(bool reliable)
+{
+    uchar *data;
+    if(msgpackets.length()) data = msgpackets.pop();
+    else { data = new uchar[MSGPACKETSIZE]; msgpacketallocs++; }
+    ENetPacket *packet = enet_packet_create(data, MSGPACKETSIZE, (reliable ? ENET_PACKET_FLAG_RELIABLE : 0) | ENET_PACKET_FLAG_NO_ALLOCATE);
+    packet->freeCallback = freemsgpacket;
+    return packet;
+}
+
+ENetPacket *sendmsgpacket(int cn, int chan, ENetPacket *packet, int len, int exclude)
+{
+    packet->dataLength = len;
+    sendpacket(cn, chan, packet, exclude);
+    if(packet->referenceCount > 0) return packet;
+    enet_packet_destroy(packet);
+    return NULL;
+}
+
+// encodes and releases a packet the way sendf does when nobody receives it
+static void formatbench(const char *format, ...)
+{
+    packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+    va_list args;
+    va_start(args, format);
+    putformat(p, format, args);
+    va_end(args);
+    p.finalize();
+}
+
+// times encoding and releasing a shot effect as sendf formats it against the typed builder;
+// nothing is sent, so it is safe to run with clients connected or a demo recording
+static void sendbench(int n)
+{
+    n = max(n, 1);
+    int allocs = msgpacketallocs;
+    enet_uint32 start = enet_time_get();
+    loopi(n) formatbench("ii9i", 60, i&127, 1, i, 1, 1000+i, -2000, 30000, 123456, i*7, 0);
+    enet_uint32 formatted = enet_time_get() - start;
+    start = enet_time_get();
+    loopi(n)
+    {
+        ENetPacket *packet = newmsgpacket(true);
+        uchar *p = packet->data;
+        putmsgfields(p, 60, i&127, 1, i, 1, 1000+i, -2000, 30000, 123456, i*7, 0);
+        packet->dataLength = p - packet->data;
+        enet_packet_destroy(packet);
+    }
+    enet_uint32 typed = enet_time_get() - start;
+    conoutf("sendbench: %d messages, sendf %u ms (%.1f ns each), typed %u ms (%.1f ns each), %d blocks allocated",
+        n, formatted, formatted*1e6f/n, typed, typed*1e6f/n, msgpacketallocs - allocs);
+}
+ICOMMAND(sendbench, "i", (int *n), sendbench(*n ? *n : 1000000));
+
 ENetPacket *sendfile(int cn, int chan, stream *file, const char *format, ...)
 {
     if(cn < 0)
@@ -305,7 +414,13 @@ const char *disconnectreason(int reason)
 
 void disconnect_client(int n, int reason)
 {
-    if(!clients.inrange(n) || clients[n]->type!=ST_TCPIP) return;
+    if(!clients.inrange(n) || (clients[n]->type!=ST_TCPIP && clients[n]->type!=ST_VIRTUAL)) return;
+    if(clients[n]->type==ST_VIRTUAL)
+    {
+        server::clientdisconnect(n);
+        delclient(clients[n]);
+        return;
+    }
     enet_peer_disconnect(clients[n]->peer, reason);
     server::clientdisconnect(n);
     delclient(clients[n]);
@@ -329,6 +444,41 @@ void process(ENetPacket *packet, int sender, int chan)   // sender may be -1
     if(p.overread()) { disconnect_client(sender, DISC_EOP); return; }
 }
 
+// virtual clients stand in for remote players without a peer, so benchmarks can drive the game through parsepacket
+int connectvirtualclient()
+{
+    client &c = addclient(ST_VIRTUAL);
+    copystring(c.hostname, "virtual");
+    int reason = server::clientconnect(c.num, 0);
+    if(!reason) return c.num;
+    disconnect_client(c.num, reason);
+    return -1;
+}
+
+void processvirtualclient(int n, int chan, uchar *data, int len)
+{
+    if(!clients.inrange(n) || clients[n]->type!=ST_VIRTUAL) return;
+    ENetPacket *packet = enet_packet_create(data, len, ENET_PACKET_FLAG_NO_ALLOCATE);
+    process(packet, n, chan);
+    if(!packet->referenceCount) enet_packet_destroy(packet);
+}
+
+void releasevirtualpackets()
+{
+    loopv(virtualpackets)
+    {
+        ENetPacket *packet = virtualpackets[i];
+        if(--packet->referenceCount <= 0) enet_packet_destroy(packet);
+    }
+    virtualpackets.setsize(0);
+}
+
+void disconnectvirtualclients()
+{
+    loopv(clients) if(clients[i]->type==ST_VIRTUAL) disconnect_client(i, DISC_NONE);
+    releasevirtualpackets();
+}
+
 void localclienttoserver(int chan, ENetPacket *packet)
 {
     client *c = NULL;
@@ -581,6 +731,7 @@ static int serverinfointercept(ENetHost *host, ENetEvent *event)
 }
 
 VAR(serveruprate, 0, 0, INT_MAX);
+VARF(serverbatch, 0, 32, ENET_HOST_MAXIMUM_BATCH, { if(serverhost) enet_host_batch(serverhost, serverbatch); });
 SVAR(serverip, "");
 VARF(serverport, 0, server::serverport(), 0xFFFF, { if(!serverport) serverport = server::serverport(); });
 
@@ -595,6 +746,324 @@ void updatemasterserver()
     lastupdatemaster = totalmillis ? totalmillis : 1;
 }
 
+// load generator for the master's auth path: opens count connections that all request a challenge at once,
+// answering with privkey when given and with garbage otherwise, while one more connection times a list request
+struct authloadconn
+{
+    ENetSocket sock;
+    uint id, sent, challenged;
+    bool done, succeeded;
+    vector<char> input;
+};
+
+static void authload(int count, const char *user, const char *privkey)
+{
+    count = clamp(count, 1, 16384);
+    ENetAddress address;
+    address.port = masterport;
+    if(!mastername[0] || enet_address_set_host(&address, mastername) < 0) { conoutf(CON_ERROR, "authload: could not resolve master %s", mastername); return; }
+    // the master limits connections per ip, so local runs spread them over the loopback range
+    bool loopback = (ENET_NET_TO_HOST_32(address.host)>>24) == 127;
+    vector<authloadconn> conns;
+    authloadconn list;
+    list.sock = ENET_SOCKET_NULL;
+    list.sent = list.challenged = 0;
+    list.done = list.succeeded = false;
+    loopi(count + 1)
+    {
+        ENetSocket sock = enet_socket_create(ENET_SOCKET_TYPE_STREAM);
+        if(sock == ENET_SOCKET_NULL) break;
+        if(loopback)
+        {
+            ENetAddress src;
+            src.host = ENET_HOST_TO_NET_32(0x7F010000 | (i+1));
+            src.port = 0;
+            enet_socket_bind(sock, &src);
+        }
+        enet_socket_set_option(sock, ENET_SOCKOPT_NONBLOCK, 1);
+        if(enet_socket_connect(sock, &address) < 0) { enet_socket_destroy(sock); break; }
+        authloadconn &c = i < count ? conns.add() : list;
+        c.sock = sock;
+        c.id = i+1;
+        c.sent = c.challenged = 0;
+        c.done = c.succeeded = false;
+    }
+    if(conns.empty()) { conoutf(CON_ERROR, "authload: could not connect to master %s:%d", mastername, masterport); return; }
+
+    loopv(conns)
+    {
+        authloadconn &c = conns[i];
+        enet_uint32 cond = ENET_SOCKET_WAIT_SEND;
+        if(enet_socket_wait(c.sock, &cond, 5000) < 0 || !(cond & ENET_SOCKET_WAIT_SEND)) { c.done = true; continue; }
+        defformatstring(req, "reqauth %u %s\n", c.id, user);
+        ENetBuffer buf;
+        buf.data = req;
+        buf.dataLength = strlen(req);
+        c.sent = getservermicros();
+        if(enet_socket_send(c.sock, NULL, &buf, 1) != int(buf.dataLength)) c.done = true;
+        if(i == conns.length()/2 && list.sock != ENET_SOCKET_NULL)
+        {
+            enet_uint32 cond = ENET_SOCKET_WAIT_SEND;
+            enet_socket_wait(list.sock, &cond, 5000);
+            buf.data = (void *)"list\n";
+            buf.dataLength = 5;
+            list.sent = getservermicros();
+            if(enet_socket_send(list.sock, NULL, &buf, 1) != 5) list.done = true;
+        }
+    }
+
+    vector<char> answer;
+    ullong total = 0;
+    uint maxwait = 0, start = getservermicros();
+    int challenged = 0, succeeded = 0, remaining = conns.length() + (list.sock != ENET_SOCKET_NULL ? 1 : 0);
+    loopv(conns) if(conns[i].done) remaining--;
+    if(list.done) remaining--;
+    while(remaining > 0 && getservermicros() - start < 60*1000000)
+    {
+        bool idle = true;
+        loopi(conns.length() + 1)
+        {
+            authloadconn &c = i < conns.length() ? conns[i] : list;
+            if(c.done || c.sock == ENET_SOCKET_NULL) continue;
+            char *data = c.input.reserve(4096).buf;
+            ENetBuffer buf;
+            buf.data = data;
+            buf.dataLength = 4096;
+            int len = enet_socket_receive(c.sock, NULL, &buf, 1);
+            if(!len) continue;
+            idle = false;
+            if(len < 0) { c.done = true; remaining--; continue; }
+            c.input.advance(len);
+            if(&c == &list)
+            {
+                // the list ends with a terminating nul, after which the master hangs up
+                if(c.input.last() == '\0') { c.done = true; remaining--; }
+                continue;
+            }
+            char *line = c.input.getbuf(), *end;
+            while((end = (char *)memchr(line, '\n', c.input.length() - (line - c.input.getbuf()))))
+            {
+                *end = '\0';
+                uint id;
+                string val;
+                if(sscanf(line, "chalauth %u %255s", &id, val) == 2)
+                {
+                    uint wait = getservermicros() - c.sent;
+                    total += wait;
+                    maxwait = max(maxwait, wait);
+                    challenged++;
+                    answer.setsize(0);
+                    if(!privkey[0] || !answerchallenge(privkey, val, answer)) { answer.setsize(0); answer.put("0", 2); }
+                    defformatstring(req, "confauth %u %s\n", id, answer.getbuf());
+                    ENetBuffer out;
+                    out.data = req;
+                    out.dataLength = strlen(req);
+                    enet_socket_send(c.sock, NULL, &out, 1);
+                }
+                else if(sscanf(line, "succauth %u", &id) == 1 || sscanf(line, "failauth %u", &id) == 1)
+                {
+                    c.succeeded = line[0] == 's';
+                    if(c.succeeded) succeeded++;
+                    c.done = true;
+                    remaining--;
+                }
+                line = end + 1;
+            }
+            c.input.remove(0, line - c.input.getbuf());
+        }
+        if(list.sock != ENET_SOCKET_NULL && list.done && !list.challenged)
+        {
+            list.challenged = getservermicros();
+            conoutf("authload: list of %d bytes answered in %.3f ms during the burst", list.input.length(), (list.challenged - list.sent)/1000.0f);
+        }
+        if(idle)
+        {
+            enet_uint32 cond = ENET_SOCKET_WAIT_NONE;
+            enet_socket_wait(conns[0].sock, &cond, 1);
+        }
+    }
+    uint elapsed = getservermicros() - start;
+    loopv(conns) enet_socket_destroy(conns[i].sock);
+    if(list.sock != ENET_SOCKET_NULL) enet_socket_destroy(list.sock);
+    conoutf("authload: %d/%d challenged (%.3f ms average, %.3f ms worst), %d succeeded, %.3f ms total",
+        challenged, conns.length(), challenged ? total/1000.0f/challenged : 0.0f, maxwait/1000.0f, succeeded, elapsed/1000.0f);
+}
+ICOMMAND(authload, "iss", (int *count, char *user, char *privkey), authload(*count ? *count : 100, user, privkey));
+
+// tick profiler: time spent per phase of each server tick, kept as log-scaled histograms over a rolling window
+
+#define TICKBUCKETBITS 4
+#define TICKLINEAR (2<<TICKBUCKETBITS)
+#define TICKMAXLOG 24
+#define TICKBUCKETS (TICKLINEAR + (TICKMAXLOG-TICKBUCKETBITS-1)*(1<<TICKBUCKETBITS))
+#define TICKSLICES 6
+
+VAR(tickprofile, 0, 1, 1);
+VAR(tickprofilewindow, 6, 60, 3600);
+VAR(tickprofilelog, 0, 60, 3600);
+
+static const char * const tickphasenames[NUMTICKPHASES] = { "tick", "update", "events", "ai", "mode", "service", "parse", "worldstate", "master" };
+
+ullong getservernanos()
+{
+#ifdef WIN32
+    static LARGE_INTEGER freq = { { 0, 0 } };
+    if(!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return ullong(double(counter.QuadPart)*1e9/freq.QuadPart);
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+uint getservermicros()
+{
+#ifdef WIN32
+    static LARGE_INTEGER freq = { { 0, 0 } };
+    if(!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return uint(counter.QuadPart*1000000/freq.QuadPart);
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint(ts.tv_sec*1000000ULL + ts.tv_nsec/1000);
+#endif
+}
+
+// microseconds map to exact buckets below TICKLINEAR, then to 2^TICKBUCKETBITS buckets per power of two
+static inline int tickbucket(uint micros)
+{
+    if(micros < TICKLINEAR) return micros;
+#ifdef __GNUC__
+    int e = 31 - __builtin_clz(micros);
+#else
+    int e = TICKBUCKETBITS+1;
+    while(e < TICKMAXLOG && micros >= (2U<<e)) e++;
+#endif
+    if(e >= TICKMAXLOG) return TICKBUCKETS-1;
+    return TICKLINEAR + (e-TICKBUCKETBITS-1)*(1<<TICKBUCKETBITS) + ((micros>>(e-TICKBUCKETBITS))&((1<<TICKBUCKETBITS)-1));
+}
+
+static inline uint tickbucketmicros(int bucket)
+{
+    if(bucket < TICKLINEAR) return bucket;
+    int e = (bucket - TICKLINEAR)/(1<<TICKBUCKETBITS) + TICKBUCKETBITS + 1, sub = (bucket - TICKLINEAR)%(1<<TICKBUCKETBITS);
+    return (((1<<TICKBUCKETBITS) + sub)<<(e-TICKBUCKETBITS)) + (1<<(e-TICKBUCKETBITS-1));
+}
+
+struct tickhistogram
+{
+    uint counts[TICKBUCKETS];
+    uint num, max;
+    ullong total;
+
+    void reset()
+    {
+        memset(counts, 0, sizeof(counts));
+        num = max = 0;
+        total = 0;
+    }
+
+    void add(uint micros)
+    {
+        counts[tickbucket(micros)]++;
+        num++;
+        total += micros;
+        max = ::max(max, micros);
+    }
+
+    void merge(const tickhistogram &h)
+    {
+        loopi(TICKBUCKETS) counts[i] += h.counts[i];
+        num += h.num;
+        total += h.total;
+        max = ::max(max, h.max);
+    }
+
+    uint percentile(float p) const
+    {
+        if(!num) return 0;
+        uint rank = uint(ceil(num*p)), seen = 0;
+        loopi(TICKBUCKETS)
+        {
+            seen += counts[i];
+            if(seen >= rank) return min(tickbucketmicros(i), max);
+        }
+        return max;
+    }
+};
+
+static tickhistogram tickslices[TICKSLICES][NUMTICKPHASES];
+static uint tickphasetime[NUMTICKPHASES];
+static int tickphaseused = 0, tickslice = 0, lasttickslice = 0, lastticklog = 0;
+
+void addtickphase(int phase, uint micros)
+{
+    tickphasetime[phase] += micros;
+    tickphaseused |= 1<<phase;
+}
+
+static void rotatetickslices()
+{
+    int slicemillis = tickprofilewindow*1000/TICKSLICES;
+    if(totalmillis - lasttickslice < slicemillis) return;
+    int steps = min((totalmillis - lasttickslice)/slicemillis, TICKSLICES);
+    loopi(steps)
+    {
+        tickslice = (tickslice + 1)%TICKSLICES;
+        loopj(NUMTICKPHASES) tickslices[tickslice][j].reset();
+    }
+    lasttickslice = totalmillis;
+}
+
+static void endtick()
+{
+    if(tickprofile)
+    {
+        rotatetickslices();
+        loopi(NUMTICKPHASES) if(tickphaseused&(1<<i)) tickslices[tickslice][i].add(tickphasetime[i]);
+    }
+    memset(tickphasetime, 0, sizeof(tickphasetime));
+    tickphaseused = 0;
+}
+
+static void gettickstats(int phase, tickhistogram &h)
+{
+    h.reset();
+    loopi(TICKSLICES) h.merge(tickslices[i][phase]);
+}
+
+static void printtickstats(bool log)
+{
+    static tickhistogram h;
+    loopi(NUMTICKPHASES)
+    {
+        gettickstats(i, h);
+        if(!h.num) continue;
+        defformatstring(msg, "tick %-10s %7d samples, avg %7.3f ms, p50 %7.3f ms, p99 %7.3f ms, max %7.3f ms",
+            tickphasenames[i], h.num, h.total/1000.0f/h.num, h.percentile(0.5f)/1000.0f, h.percentile(0.99f)/1000.0f, h.max/1000.0f);
+        if(log) logoutf("%s", msg);
+        else conoutf("%s", msg);
+    }
+}
+
+static void resettickstats()
+{
+    loopi(TICKSLICES) loopj(NUMTICKPHASES) tickslices[i][j].reset();
+    lasttickslice = totalmillis;
+}
+
+ICOMMAND(tickstats, "", (),
+{
+    if(!tickprofile) conoutf("tick profiling is disabled");
+    else printtickstats(false);
+});
+ICOMMAND(resettickstats, "", (), resettickstats());
+
 uint totalsecs = 0;
 
 void updatetime()
@@ -608,12 +1077,409 @@ void updatetime()
     }
 }
 
+// network compression: ENet's range coder, used only towards peers that asked for it when connecting
+// and only on datagrams large enough to gain from it
+
+VARF(servercompress, 0, 0, 1,
+{
+    if(!serverhost) return;
+    if(!servercompress) enet_host_compress(serverhost, NULL);
+    else if(!serverhost->compressor.context) setupnetcompress(serverhost);
+});
+VAR(compressmin, 0, 128, 4096);
+
+struct netcompressor
+{
+    void *coder;
+    uint skipped, attempts, gains, decompressed;
+    ullong compressmicros, decompressmicros, rawbytes, savedbytes;
+
+    netcompressor() : coder(enet_range_coder_create()), skipped(0), attempts(0), gains(0), decompressed(0), compressmicros(0), decompressmicros(0), rawbytes(0), savedbytes(0) {}
+    ~netcompressor() { if(coder) enet_range_coder_destroy(coder); }
+
+    static size_t compress(void *context, const ENetBuffer *inbufs, size_t numinbufs, size_t inlimit, enet_uint8 *out, size_t outlimit)
+    {
+        netcompressor &c = *(netcompressor *)context;
+        if(inlimit < size_t(compressmin)) { c.skipped++; return 0; }
+        uint start = getservermicros();
+        size_t len = enet_range_coder_compress(c.coder, inbufs, numinbufs, inlimit, out, outlimit);
+        c.compressmicros += getservermicros() - start;
+        c.attempts++;
+        c.rawbytes += inlimit;
+        if(len > 0 && len < inlimit)
+        {
+            c.gains++;
+            c.savedbytes += inlimit - len;
+        }
+        return len;
+    }
+
+    static size_t decompress(void *context, const enet_uint8 *in, size_t inlimit, enet_uint8 *out, size_t outlimit)
+    {
+        netcompressor &c = *(netcompressor *)context;
+        uint start = getservermicros();
+        size_t len = enet_range_coder_decompress(c.coder, in, inlimit, out, outlimit);
+        c.decompressmicros += getservermicros() - start;
+        c.decompressed++;
+        return len;
+    }
+
+    static void destroy(void *context) { delete (netcompressor *)context; }
+};
+
+// lets host decode compressed datagrams; it only compresses towards peers flagged with ENET_PEER_FLAG_COMPRESS
+void setupnetcompress(ENetHost *host)
+{
+    netcompressor *c = new netcompressor;
+    if(!c->coder) { delete c; return; }
+    ENetCompressor compressor = { c, netcompressor::compress, netcompressor::decompress, netcompressor::destroy };
+    enet_host_compress(host, &compressor);
+}
+
+static netcompressor *getnetcompressor(ENetHost *host)
+{
+    return host && host->compressor.compress == netcompressor::compress ? (netcompressor *)host->compressor.context : NULL;
+}
+
+ICOMMAND(compressstats, "", (),
+{
+    netcompressor *c = getnetcompressor(serverhost);
+    if(!c) { conoutf("network compression is off"); return; }
+    int peers = 0;
+    loopv(clients) if(clients[i]->type == ST_TCPIP && clients[i]->peer && clients[i]->peer->flags & ENET_PEER_FLAG_COMPRESS) peers++;
+    conoutf("network compression: %d peers, %u datagrams compressed of %u tried, %u too small to try", peers, c->gains, c->attempts, c->skipped);
+    conoutf("network compression: %.1f kB saved of %.1f kB, %.3f ms spent (%.1f kB saved per ms), %u decompressed in %.3f ms",
+        c->savedbytes/1024.0f, c->rawbytes/1024.0f, c->compressmicros/1000.0f, c->compressmicros ? c->savedbytes/1024.0f/(c->compressmicros/1000.0f) : 0.0f,
+        c->decompressed, c->decompressmicros/1000.0f);
+});
+
+static const char * const netpoolnames[ENET_POOL_COUNT] = { "packet", "outgoing", "incoming", "ack", "data64", "data256", "data1024", "data8192", "datalarge" };
+
+ICOMMAND(netpoolstats, "", (),
+{
+    ENetPoolStats stats[ENET_POOL_COUNT];
+    enet_pool_stats(stats);
+    loopi(ENET_POOL_COUNT)
+        conoutf("network pool %s: %u reused, %u allocated, %u freed past the limit, %u pooled", netpoolnames[i], stats[i].hits, stats[i].misses, stats[i].overflows, stats[i].pooled);
+});
+
+// compresses datagrams as they would be sent, at a range of size thresholds, to help pick compressmin
+void netcompressbench(const vector<uchar> &data, const vector<int> &datagrams)
+{
+    static const int thresholds[] = { 0, 32, 64, 128, 256, 512, 1024 };
+    void *coder = enet_range_coder_create();
+    if(!coder) return;
+    uchar out[ENET_PROTOCOL_MAXIMUM_MTU];
+    llong total = 0;
+    loopv(datagrams) total += datagrams[i];
+    conoutf("compressbench: %d datagrams, %.1f kB", datagrams.length(), total/1024.0f);
+    loopj(sizeof(thresholds)/sizeof(thresholds[0]))
+    {
+        int tried = 0, gains = 0;
+        llong saved = 0;
+        uint start = getservermicros();
+        const uchar *cur = data.getbuf();
+        loopv(datagrams)
+        {
+            int len = datagrams[i];
+            if(len >= thresholds[j] && len <= int(sizeof(out)))
+            {
+                ENetBuffer buf;
+                buf.data = (void *)cur;
+                buf.dataLength = len;
+                size_t packed = enet_range_coder_compress(coder, &buf, 1, len, out, len);
+                tried++;
+                if(packed > 0 && packed < size_t(len)) { gains++; saved += len - packed; }
+            }
+            cur += len;
+        }
+        uint elapsed = getservermicros() - start;
+        conoutf("compressmin %4d: %d tried, %d smaller, %.1f%% saved, %.3f ms (%.2f us per kB sent, %.1f kB saved per ms)",
+            thresholds[j], tried, gains, total ? saved*100.0f/total : 0.0f, elapsed/1000.0f, total ? elapsed*1024.0f/total : 0.0f, elapsed ? saved/1024.0f/(elapsed/1000.0f) : 0.0f);
+    }
+    enet_range_coder_destroy(coder);
+}
+
+// drains every event of a benchmark host without waiting, returning the packets received
+static int drainbenchhost(ENetHost *host, int *connected = NULL)
+{
+    int received = 0;
+    ENetEvent event;
+    while(enet_host_service(host, &event, 0) > 0) switch(event.type)
+    {
+        case ENET_EVENT_TYPE_CONNECT: if(connected) (*connected)++; break;
+        case ENET_EVENT_TYPE_RECEIVE: received++; enet_packet_destroy(event.packet); break;
+        default: break;
+    }
+    return received;
+}
+
+// exchanges a packet each way with every peer over loopback per round, timing the server side with and without batched socket calls
+static void netbatchbench(int peers, int rounds, int size)
+{
+    peers = clamp(peers, 1, MAXCLIENTS);
+    rounds = max(rounds, 1);
+    size = clamp(size, 1, 1024);
+    ENetAddress address = { ENET_HOST_ANY, 0 };
+    enet_address_set_host(&address, "127.0.0.1");
+    ENetHost *server = enet_host_create(&address, peers, 1, 0, 0), *client = enet_host_create(NULL, peers, 1, 0, 0);
+    if(!server || !client || enet_socket_get_address(server->socket, &address) < 0)
+    {
+        conoutf(CON_ERROR, "netbatchbench: could not create loopback hosts");
+        if(server) enet_host_destroy(server);
+        if(client) enet_host_destroy(client);
+        return;
+    }
+    enet_address_set_host(&address, "127.0.0.1");
+    loopi(peers) enet_host_connect(client, &address, 1, 0);
+    int connected = 0;
+    for(uint start = getservermicros(); connected < peers && getservermicros() - start < 5000000;)
+    {
+        drainbenchhost(client);
+        drainbenchhost(server, &connected);
+    }
+    if(connected < peers) conoutf(CON_WARN, "netbatchbench: only %d of %d peers connected", connected, peers);
+    uchar *data = new uchar[size];
+    memset(data, 0x55, size);
+    loopj(2)
+    {
+        int batch = j ? ENET_HOST_MAXIMUM_BATCH : 0;
+        enet_host_batch(server, batch);
+        enet_host_batch(client, batch);
+        uint sendmicros = 0, recvmicros = 0;
+        int sent = 0, received = 0;
+        loopi(rounds)
+        {
+            uint start = getservermicros();
+            enet_host_broadcast(server, 0, enet_packet_create(data, size, ENET_PACKET_FLAG_RELIABLE));
+            enet_host_flush(server);
+            sendmicros += getservermicros() - start;
+            sent += connected;
+            drainbenchhost(client);
+            loopk(client->peerCount) if(client->peers[k].state == ENET_PEER_STATE_CONNECTED)
+                enet_peer_send(&client->peers[k], 0, enet_packet_create(data, size, ENET_PACKET_FLAG_RELIABLE));
+            enet_host_flush(client);
+            start = getservermicros();
+            received += drainbenchhost(server);
+            recvmicros += getservermicros() - start;
+        }
+        conoutf("netbatchbench: batch %2d, %d peers, %d rounds: flush %.1f us, receive %.1f us per round, %d sent, %d received",
+            batch, connected, rounds, sendmicros/float(rounds), recvmicros/float(rounds), sent, received);
+    }
+    delete[] data;
+    enet_host_destroy(client);
+    enet_host_destroy(server);
+}
+ICOMMAND(netbatchbench, "iii", (int *peers, int *rounds, int *size), netbatchbench(*peers ? *peers : 64, *rounds ? *rounds : 2000, *size ? *size : 64));
+
+// metrics: counters and gauges served as plain text over TCP, from a snapshot rebuilt by the server loop
+
+#define MAXMETRICSCLIENTS 16
+#define MAXMETRICSREQUEST 1024
+
+VAR(metricsport, 0, 0, 0xFFFF);
+SVAR(metricsip, "127.0.0.1");
+VAR(metricsinterval, 100, 1000, 60000);
+VAR(metricstimeout, 1000, 5000, 60000);
+
+void metricf(vector<char> &buf, const char *fmt, ...)
+{
+    defvformatstring(line, fmt, fmt);
+    buf.put(line, strlen(line));
+    buf.add('\n');
+}
+
+struct metricsclient
+{
+    ENetSocket sock;
+    int connectmillis, sent;
+    vector<char> request, response;
+};
+
+static ENetSocket metricssock = ENET_SOCKET_NULL;
+static vector<metricsclient *> metricsclients;
+static vector<char> metricssnapshot;
+static int lastmetrics = 0;
+
+static void buildmetrics()
+{
+    vector<char> &buf = metricssnapshot;
+    buf.setsize(0);
+    metricf(buf, "valhalla_uptime_seconds %u", totalsecs);
+    metricf(buf, "valhalla_clients{type=\"remote\"} %d", nonlocalclients);
+    metricf(buf, "valhalla_clients{type=\"local\"} %d", localclients);
+    metricf(buf, "valhalla_max_clients %d", maxclients);
+    loopi(min(server::numchannels(), METRICSCHANNELS))
+    {
+        metricf(buf, "valhalla_sent_bytes_total{channel=\"%d\"} %llu", i, metricsendbytes[i]);
+        metricf(buf, "valhalla_sent_packets_total{channel=\"%d\"} %llu", i, metricsendpackets[i]);
+        metricf(buf, "valhalla_received_bytes_total{channel=\"%d\"} %llu", i, metricrecvbytes[i]);
+        metricf(buf, "valhalla_received_packets_total{channel=\"%d\"} %llu", i, metricrecvpackets[i]);
+    }
+    if(tickprofile)
+    {
+        static tickhistogram h;
+        loopi(NUMTICKPHASES)
+        {
+            gettickstats(i, h);
+            const char *name = tickphasenames[i];
+            metricf(buf, "valhalla_tick_seconds{phase=\"%s\",quantile=\"0.5\"} %.6f", name, h.percentile(0.5f)/1e6f);
+            metricf(buf, "valhalla_tick_seconds{phase=\"%s\",quantile=\"0.99\"} %.6f", name, h.percentile(0.99f)/1e6f);
+            metricf(buf, "valhalla_tick_seconds{phase=\"%s\",quantile=\"1\"} %.6f", name, h.max/1e6f);
+            metricf(buf, "valhalla_tick_seconds_sum{phase=\"%s\"} %.6f", name, h.total/1e6);
+            metricf(buf, "valhalla_tick_seconds_count{phase=\"%s\"} %u", name, h.num);
+        }
+    }
+    if(netcompressor *c = getnetcompressor(serverhost))
+    {
+        metricf(buf, "valhalla_compress_datagrams_total{result=\"skipped\"} %u", c->skipped);
+        metricf(buf, "valhalla_compress_datagrams_total{result=\"unchanged\"} %u", c->attempts - c->gains);
+        metricf(buf, "valhalla_compress_datagrams_total{result=\"compressed\"} %u", c->gains);
+        metricf(buf, "valhalla_compress_input_bytes_total %llu", c->rawbytes);
+        metricf(buf, "valhalla_compress_saved_bytes_total %llu", c->savedbytes);
+        metricf(buf, "valhalla_compress_seconds_total %.6f", c->compressmicros/1e6);
+        metricf(buf, "valhalla_decompress_seconds_total %.6f", c->decompressmicros/1e6);
+    }
+    ENetPoolStats pools[ENET_POOL_COUNT];
+    enet_pool_stats(pools);
+    loopi(ENET_POOL_COUNT)
+    {
+        metricf(buf, "valhalla_net_pool_allocations_total{pool=\"%s\",result=\"reused\"} %u", netpoolnames[i], pools[i].hits);
+        metricf(buf, "valhalla_net_pool_allocations_total{pool=\"%s\",result=\"allocated\"} %u", netpoolnames[i], pools[i].misses);
+        metricf(buf, "valhalla_net_pool_blocks{pool=\"%s\"} %u", netpoolnames[i], pools[i].pooled);
+    }
+    server::writemetrics(buf);
+    lastmetrics = totalmillis;
+}
+
+static void closemetricsclient(int i)
+{
+    metricsclient *c = metricsclients[i];
+    enet_socket_destroy(c->sock);
+    delete c;
+    metricsclients.remove(i);
+}
+
+void cleanupmetrics()
+{
+    loopvrev(metricsclients) closemetricsclient(i);
+    if(metricssock != ENET_SOCKET_NULL) enet_socket_destroy(metricssock);
+    metricssock = ENET_SOCKET_NULL;
+    metricssnapshot.setsize(0);
+}
+
+static bool setupmetrics()
+{
+    cleanupmetrics();
+    if(!metricsport) return false;
+    ENetAddress address = { ENET_HOST_ANY, enet_uint16(metricsport) };
+    if(*metricsip && enet_address_set_host(&address, metricsip) < 0)
+    {
+        conoutf(CON_WARN, "metrics IP not resolved");
+        return false;
+    }
+    metricssock = enet_socket_create(ENET_SOCKET_TYPE_STREAM);
+    if(metricssock != ENET_SOCKET_NULL && (enet_socket_set_option(metricssock, ENET_SOCKOPT_REUSEADDR, 1) < 0 || enet_socket_bind(metricssock, &address) < 0 || enet_socket_listen(metricssock, MAXMETRICSCLIENTS) < 0))
+    {
+        enet_socket_destroy(metricssock);
+        metricssock = ENET_SOCKET_NULL;
+    }
+    if(metricssock == ENET_SOCKET_NULL)
+    {
+        conoutf(CON_WARN, "could not create metrics socket on port %d", metricsport);
+        return false;
+    }
+    enet_socket_set_option(metricssock, ENET_SOCKOPT_NONBLOCK, 1);
+    buildmetrics();
+    return true;
+}
+
+// answers a request once its first line is in: HTTP requests are read up to the blank line and get a header, anything else gets the bare text
+static bool metricsrequestdone(metricsclient &c)
+{
+    c.request.add('\0');
+    const char *req = c.request.getbuf();
+    bool http = !strncmp(req, "GET ", 4) || !strncmp(req, "HEAD ", 5);
+    bool done = http ? strstr(req, "\r\n\r\n") || strstr(req, "\n\n") : strchr(req, '\n') != NULL;
+    c.request.pop();
+    if(!done && c.request.length() < MAXMETRICSREQUEST) return false;
+    if(http)
+    {
+        bool head = req[0] == 'H';
+        defformatstring(header, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", metricssnapshot.length());
+        c.response.put(header, strlen(header));
+        if(head) return true;
+    }
+    c.response.put(metricssnapshot.getbuf(), metricssnapshot.length());
+    return true;
+}
+
+static void checkmetrics()
+{
+    if(metricssock == ENET_SOCKET_NULL) return;
+    if(totalmillis - lastmetrics >= metricsinterval) buildmetrics();
+
+    static ENetSocketSet readset, writeset;
+    ENET_SOCKETSET_EMPTY(readset);
+    ENET_SOCKETSET_EMPTY(writeset);
+    ENetSocket maxsock = metricssock;
+    ENET_SOCKETSET_ADD(readset, metricssock);
+    loopvrev(metricsclients)
+    {
+        metricsclient &c = *metricsclients[i];
+        if(totalmillis - c.connectmillis >= metricstimeout) { closemetricsclient(i); continue; }
+        if(c.response.empty()) ENET_SOCKETSET_ADD(readset, c.sock);
+        else ENET_SOCKETSET_ADD(writeset, c.sock);
+        maxsock = max(maxsock, c.sock);
+    }
+    if(enet_socketset_select(maxsock, &readset, &writeset, 0) <= 0) return;
+
+    loopvrev(metricsclients)
+    {
+        metricsclient &c = *metricsclients[i];
+        ENetBuffer buf;
+        if(c.response.empty())
+        {
+            if(!ENET_SOCKETSET_CHECK(readset, c.sock)) continue;
+            char data[256];
+            buf.data = data;
+            buf.dataLength = min(int(sizeof(data)), MAXMETRICSREQUEST - c.request.length());
+            int len = enet_socket_receive(c.sock, NULL, &buf, 1);
+            if(len <= 0) { closemetricsclient(i); continue; }
+            c.request.put(data, len);
+            if(!metricsrequestdone(c)) continue;
+        }
+        else if(!ENET_SOCKETSET_CHECK(writeset, c.sock)) continue;
+        buf.data = &c.response[c.sent];
+        buf.dataLength = c.response.length() - c.sent;
+        int sent = enet_socket_send(c.sock, NULL, &buf, 1);
+        if(sent < 0) { closemetricsclient(i); continue; }
+        c.sent += sent;
+        if(c.sent >= c.response.length()) closemetricsclient(i);
+    }
+
+    if(ENET_SOCKETSET_CHECK(readset, metricssock))
+    {
+        ENetAddress address;
+        ENetSocket sock = enet_socket_accept(metricssock, &address);
+        if(sock == ENET_SOCKET_NULL) return;
+        if(metricsclients.length() >= MAXMETRICSCLIENTS) { enet_socket_destroy(sock); return; }
+        enet_socket_set_option(sock, ENET_SOCKOPT_NONBLOCK, 1);
+        metricsclient *c = new metricsclient;
+        c->sock = sock;
+        c->connectmillis = totalmillis;
+        c->sent = 0;
+        metricsclients.add(c);
+    }
+}
+
 void serverslice(bool dedicated, uint timeout)   // main server update, called from main loop in sp, or from below in dedicated server
 {
     if(!serverhost)
     {
         server::serverupdate();
         server::sendpackets();
+        endtick();
         return;
     }
 
@@ -632,10 +1498,18 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
         totalmillis = millis;
         updatetime();
     }
-    server::serverupdate();
+    uint tickstart = getservermicros(), idle = 0;
+    {
+        tickscope scope(TICK_UPDATE);
+        server::serverupdate();
+    }
 
-    flushmasteroutput();
+    {
+        tickscope scope(TICK_MASTER);
+        flushmasteroutput();
+    }
     checkserversockets();
+    checkmetrics();
 
     if(!lastupdatemaster || totalmillis-lastupdatemaster>60*60*1000)       // send alive signal to masterserver every hour of uptime
         updatemasterserver();
@@ -647,13 +1521,35 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
         serverhost->totalSentData = serverhost->totalReceivedData = 0;
     }
 
+    if(tickprofilelog && totalmillis-lastticklog>tickprofilelog*1000)
+    {
+        lastticklog = totalmillis;
+        if(tickprofile && nonlocalclients) printtickstats(true);
+    }
+
     ENetEvent event;
-    bool serviced = false;
+    bool serviced = false, waited = false;
     while(!serviced)
     {
         if(enet_host_check_events(serverhost, &event) <= 0)
         {
-            if(enet_host_service(serverhost, &event, timeout) <= 0) break;
+            uint servicestart = getservermicros();
+            int serviceresult = enet_host_service(serverhost, &event, 0);
+            addtickphase(TICK_SERVICE, getservermicros() - servicestart);
+            if(serviceresult <= 0)
+            {
+                if(serviceresult < 0 || waited) break;
+                // datagrams left over from a batched receive are not seen by the socket, so service them before waiting
+                if(serverhost->receiveBatchIndex < serverhost->receiveBatchCount) continue;
+                // the wait for the socket is timed apart from servicing it and only counts as idle
+                uint waitstart = getservermicros();
+                enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+                int waitresult = enet_socket_wait(serverhost->socket, &condition, timeout);
+                idle += getservermicros() - waitstart;
+                if(waitresult < 0 || !(condition&ENET_SOCKET_WAIT_RECEIVE)) break;
+                waited = true;
+                continue;
+            }
             serviced = true;
         }
         switch(event.type)
@@ -663,6 +1559,7 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
                 client &c = addclient(ST_TCPIP);
                 c.peer = event.peer;
                 c.peer->data = &c;
+                if(servercompress && event.data&CONNECT_COMPRESS) c.peer->flags |= ENET_PEER_FLAG_COMPRESS;
                 string hn;
                 copystring(c.hostname, (enet_address_get_host_ip(&c.peer->address, hn, sizeof(hn))==0) ? hn : "unknown");
                 logoutf("client connected (%s)", c.hostname);
@@ -673,7 +1570,12 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
             case ENET_EVENT_TYPE_RECEIVE:
             {
                 client *c = (client *)event.peer->data;
-                if(c) process(event.packet, c->num, event.channelID);
+                countrecv(event.channelID, event.packet->dataLength);
+                if(c)
+                {
+                    tickscope scope(TICK_PARSE);
+                    process(event.packet, c->num, event.channelID);
+                }
                 if(event.packet->referenceCount==0) enet_packet_destroy(event.packet);
                 break;
             }
@@ -691,6 +1593,8 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
         }
     }
     if(server::sendpackets()) enet_host_flush(serverhost);
+    addtickphase(TICK_TOTAL, getservermicros() - tickstart - idle);
+    endtick();
 }
 
 void flushserver(bool force)
@@ -1050,6 +1954,8 @@ bool setuplistenserver(bool dedicated)
     if(!serverhost) return servererror(dedicated, "Could not create server host. Server may be already running.");
     serverhost->duplicatePeers = maxdupclients ? maxdupclients : MAXCLIENTS;
     serverhost->intercept = serverinfointercept;
+    if(servercompress) setupnetcompress(serverhost);
+    enet_host_batch(serverhost, serverbatch);
     address.port = server::laninfoport();
     lansock = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
     if(lansock != ENET_SOCKET_NULL && (enet_socket_set_option(lansock, ENET_SOCKOPT_REUSEADDR, 1) < 0 || enet_socket_bind(lansock, &address) < 0))
@@ -1059,9 +1965,108 @@ bool setuplistenserver(bool dedicated)
     }
     if(lansock == ENET_SOCKET_NULL) conoutf(CON_WARN, "could not create LAN server info socket");
     else enet_socket_set_option(lansock, ENET_SOCKOPT_NONBLOCK, 1);
+    if(dedicated) setupmetrics();
     return true;
 }
 
+#ifdef STANDALONE
+// arenas: one dedicated server process hosting several games on consecutive ports.
+// each arena is a forked copy of the configured server, so the config, attack tables and
+// geoip database loaded so far stay shared, while game state stays separate per process
+VAR(serverarenas, 1, 1, 64);
+VAR(arenaaffinity, 0, 1, 1);
+
+#ifndef WIN32
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/prctl.h>
+#endif
+
+static vector<pid_t> arenapids;
+
+static void stoparenas(int sig)
+{
+    loopv(arenapids) if(arenapids[i] > 0) kill(arenapids[i], SIGTERM);
+    _exit(EXIT_SUCCESS);
+}
+
+// returns the pid of the started arena in the supervisor, and 0 inside the arena itself
+static pid_t forkarena(int n)
+{
+    fflush(getlogfile());
+    pid_t pid = fork();
+    if(pid) return pid;
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+#ifdef __linux__
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(arenaaffinity && cpus > 1)
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET((n-1)%cpus, &cpuset);
+        if(sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0) conoutf(CON_WARN, "could not pin arena %d to a core", n);
+    }
+#endif
+    formatstring(logprefix, "[arena %d] ", n);
+    serverport = (serverport <= 0 ? server::serverport() : serverport) + n-1;
+    if(metricsport) metricsport += n-1;
+    if(ident *id = getident("demostore")) if(id->type == ID_SVAR && (*id->storage.s)[0])
+    {
+        defformatstring(store, "%s%d", *id->storage.s, n);
+        setsvar("demostore", store);
+    }
+    defformatstring(cfg, "config/server/arena%d.cfg", n);
+    execfile(cfg, false);
+    return 0;
+}
+
+// keeps the arenas running, restarting any that exits unless it failed straight after starting
+static void runarenas()
+{
+    int port = serverport <= 0 ? server::serverport() : serverport;
+    logoutf("starting %d arenas on ports %d-%d", serverarenas, port, port + serverarenas-1);
+    vector<time_t> started;
+    loopi(serverarenas)
+    {
+        pid_t pid = forkarena(i+1);
+        if(!pid) return;
+        if(pid < 0) fatal("could not start arena %d", i+1);
+        arenapids.add(pid);
+        started.add(time(NULL));
+    }
+    signal(SIGINT, stoparenas);
+    signal(SIGTERM, stoparenas);
+    int running = arenapids.length();
+    while(running > 0)
+    {
+        int status = 0;
+        pid_t pid = wait(&status);
+        if(pid < 0) { if(errno == EINTR) continue; break; }
+        int n = arenapids.find(pid);
+        if(n < 0) continue;
+        arenapids[n] = 0;
+        if(WIFSIGNALED(status)) logoutf("arena %d was killed by signal %d", n+1, WTERMSIG(status));
+        else logoutf("arena %d exited with status %d", n+1, WEXITSTATUS(status));
+        if(time(NULL) - started[n] < 10) { logoutf("arena %d failed on startup, not restarting it", n+1); running--; continue; }
+        sleep(1);
+        pid = forkarena(n+1);
+        if(!pid) return;
+        if(pid < 0) { running--; continue; }
+        arenapids[n] = pid;
+        started[n] = time(NULL);
+    }
+    exit(EXIT_FAILURE);
+}
+#endif
+#endif
+
 void initserver(bool listen, bool dedicated)
 {
     if(dedicated)
@@ -1073,6 +2078,17 @@ void initserver(bool listen, bool dedicated)
 
     bool isconfigured = execfile("config/server/init.cfg", false);
 
+#ifdef STANDALONE
+    if(listen && dedicated && serverarenas > 1)
+    {
+#ifdef WIN32
+        conoutf(CON_WARN, "arenas are not supported on this platform, starting a single server");
+#else
+        runarenas(); // only returns inside an arena
+#endif
+    }
+#endif
+
     if(listen) setuplistenserver(dedicated);
 
     server::serverinit();
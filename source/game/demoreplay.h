@@ -0,0 +1,492 @@
+// demo replay benchmark: rebuilds the client traffic behind a recorded demo and feeds it through parsepacket
+// and serverupdate on a virtual clock, with virtual clients standing in for the recorded players
+
+#define REPLAYTICK 40
+
+struct replaystat
+{
+    int count;
+    ullong nanos, bytes;
+};
+
+struct demoreplay
+{
+    int virtualcn[MAXCLIENTS];
+    int shooter, replaymillis, lastsend, ticks, joins;
+    vector<int> shothits;
+    replaystat stats[NUMMSG];
+    ullong ticknanos, maxticknanos;
+
+    demoreplay() : shooter(-1), replaymillis(0), lastsend(0), ticks(0), joins(0), ticknanos(0), maxticknanos(0)
+    {
+        loopi(MAXCLIENTS) virtualcn[i] = -1;
+        memset(stats, 0, sizeof(stats));
+    }
+
+    clientinfo *getvirtual(int cn)
+    {
+        if(cn < 0 || cn >= MAXCLIENTS || virtualcn[cn] < 0) return NULL;
+        clientinfo *ci = getinfo(virtualcn[cn]);
+        return ci && ci->connected ? ci : NULL;
+    }
+
+    void feed(clientinfo *ci, int chan, int type, packetbuf &p)
+    {
+        ullong start = getservernanos();
+        processvirtualclient(ci->clientnum, chan, p.buf, p.len);
+        ullong elapsed = getservernanos() - start;
+        if(type < 0 || type >= NUMMSG) return;
+        replaystat &s = stats[type];
+        s.count++;
+        s.nanos += elapsed;
+        s.bytes += p.len;
+    }
+
+    // feeds one message copied from a recording, starting at its type
+    void feedmsg(clientinfo *ci, int chan, int type, const uchar *data, int len)
+    {
+        packetbuf p(len, 0);
+        p.put(data, len);
+        feed(ci, chan, type, p);
+    }
+
+    void tick(int step)
+    {
+        curtime = step;
+        lastmillis += step;
+        totalmillis += step;
+        replaymillis += step;
+        ullong start = getservernanos();
+        serverupdate();
+        if(totalmillis - lastsend >= REPLAYTICK)
+        {
+            lastsend = totalmillis;
+            sendpackets(true);
+        }
+        releasevirtualpackets();
+        ullong elapsed = getservernanos() - start;
+        ticknanos += elapsed;
+        maxticknanos = max(maxticknanos, elapsed);
+        ticks++;
+    }
+
+    void advance(int millis)
+    {
+        while(replaymillis < millis) tick(min(millis - replaymillis, REPLAYTICK));
+    }
+
+    void spawn(clientinfo *ci)
+    {
+        if(ci->state.state == CS_DEAD && ci->state.lastspawn < 0)
+        {
+            packetbuf p(16, 0);
+            putint(p, N_TRYSPAWN);
+            feed(ci, 1, N_TRYSPAWN, p);
+        }
+        if((ci->state.state == CS_ALIVE || ci->state.state == CS_DEAD) && ci->state.lastspawn >= 0)
+        {
+            packetbuf p(16, 0);
+            putint(p, N_SPAWN);
+            putint(p, ci->state.lifesequence);
+            putint(p, ci->state.gunselect);
+            feed(ci, 1, N_SPAWN, p);
+        }
+    }
+
+    void join(int cn, const char *name, int model, int color)
+    {
+        if(cn < 0 || cn >= MAXCLIENTS || getvirtual(cn)) return;
+        int n = connectvirtualclient();
+        clientinfo *ci = n >= 0 ? getinfo(n) : NULL;
+        if(!ci) return;
+        packetbuf p(MAXTRANS, 0);
+        putint(p, N_CONNECT);
+        sendstring(name, p);
+        putint(p, model);
+        putint(p, color);
+        loopi(4) sendstring("", p);
+        feed(ci, 1, N_CONNECT, p);
+        if(!ci->connected) return;
+        virtualcn[cn] = n;
+        joins++;
+        spawn(ci);
+    }
+
+    void leave(int cn)
+    {
+        clientinfo *ci = getvirtual(cn);
+        if(ci) disconnect_client(ci->clientnum, DISC_NONE);
+        if(cn >= 0 && cn < MAXCLIENTS) virtualcn[cn] = -1;
+    }
+
+    // a shot is recorded as its event, the damage it dealt and then its effect, which is where it is rebuilt
+    void shoot(int cn, int atk, int id, const ivec &from, const ivec &to)
+    {
+        clientinfo *ci = getvirtual(cn);
+        if(!ci || !validatk(atk)) return;
+        if(attacks[atk].gun != ci->state.gunselect)
+        {
+            packetbuf g(16, 0);
+            putint(g, N_GUNSELECT);
+            putint(g, attacks[atk].gun);
+            feed(ci, 1, N_GUNSELECT, g);
+        }
+        vec vfrom = vec(from).div(DMF), vto = vec(to).div(DMF), dir = vec(vto).sub(vfrom).safenormalize();
+        packetbuf p(MAXTRANS, 0);
+        putint(p, N_SHOOT);
+        putint(p, id);
+        putint(p, atk);
+        loopk(3) putint(p, from[k]);
+        loopk(3) putint(p, to[k]);
+        int numhits = 0;
+        loopv(shothits) if(getvirtual(shothits[i])) numhits++;
+        putint(p, numhits);
+        loopv(shothits)
+        {
+            clientinfo *target = getvirtual(shothits[i]);
+            if(!target) continue;
+            putint(p, target->clientnum);
+            putint(p, target->state.lifesequence);
+            putint(p, int(vto.dist(vfrom)*DMF));
+            putint(p, 1);
+            putint(p, 0);
+            loopk(3) putint(p, int(dir[k]*DNF));
+        }
+        feed(ci, 1, N_SHOOT, p);
+    }
+
+    static bool skipmsg(ucharbuf &p, int type)
+    {
+        int size = msgsizelookup(type);
+        if(size <= 0) return false;
+        loopi(size-1) getint(p);
+        return !p.overread();
+    }
+
+    // messages the server relayed from one client, which are client format except for spawns and renames
+    void relay(int cn, ucharbuf &p)
+    {
+        clientinfo *ci = getvirtual(cn);
+        if(!ci) return;
+        while(p.remaining())
+        {
+            int start = p.len, type = getint(p);
+            switch(type)
+            {
+                case N_SPAWN:
+                    loopi(5 + NUMGUNS) getint(p);
+                    spawn(ci);
+                    break;
+
+                case N_SWITCHNAME:
+                {
+                    char text[MAXTRANS];
+                    getstring(text, p);
+                    feedmsg(ci, 1, type, &p.buf[start], p.len - start);
+                    break;
+                }
+
+                default:
+                    if(!skipmsg(p, type)) return;
+                    feedmsg(ci, 1, type, &p.buf[start], p.len - start);
+                    break;
+            }
+            if(p.overread()) return;
+        }
+    }
+
+    void positions(ucharbuf &p)
+    {
+        while(p.remaining())
+        {
+            int start = p.len, type = getint(p);
+            switch(type)
+            {
+                case N_POS:
+                {
+                    int cn = getuint(p), body = p.len;
+                    posstate ps;
+                    p.len = start;
+                    getint(p);
+                    ps.parse(p);
+                    if(p.overread()) return;
+                    clientinfo *ci = getvirtual(cn);
+                    if(!ci) break;
+                    // the recorded client number is rewritten to the virtual client's own
+                    packetbuf q(p.len - start + 8, 0);
+                    putint(q, N_POS);
+                    putuint(q, ci->clientnum);
+                    q.put(&p.buf[body], p.len - body);
+                    feed(ci, 0, N_POS, q);
+                    break;
+                }
+
+                case N_TELEPORT:
+                case N_JUMPPAD:
+                {
+                    int cn = getint(p), a = getint(p), b = type == N_TELEPORT ? getint(p) : 0;
+                    clientinfo *ci = getvirtual(cn);
+                    if(p.overread()) return;
+                    if(!ci) break;
+                    packetbuf q(16, 0);
+                    putint(q, type);
+                    putint(q, ci->clientnum);
+                    putint(q, a);
+                    if(type == N_TELEPORT) putint(q, b);
+                    feed(ci, 1, type, q);
+                    break;
+                }
+
+                default: return;
+            }
+        }
+    }
+
+    void messages(ucharbuf &p)
+    {
+        char text[MAXTRANS];
+        while(p.remaining())
+        {
+            int type = getint(p);
+            switch(type)
+            {
+                case N_CLIENT:
+                {
+                    int cn = getint(p), len = getuint(p);
+                    ucharbuf q = p.subbuf(len);
+                    relay(cn, q);
+                    break;
+                }
+
+                case N_INITCLIENT:
+                {
+                    int cn = getint(p);
+                    getint(p);
+                    string name;
+                    getstring(name, p, sizeof(name));
+                    getint(p);
+                    int model = getint(p), color = getint(p);
+                    getstring(text, p);
+                    getstring(text, p);
+                    if(!p.overread()) join(cn, name, model, color);
+                    break;
+                }
+
+                case N_CDIS:
+                    leave(getint(p));
+                    break;
+
+                case N_SHOTEVENT:
+                    shooter = getint(p);
+                    getint(p);
+                    shothits.setsize(0);
+                    break;
+
+                case N_DAMAGE:
+                {
+                    int target = getint(p), actor = getint(p);
+                    loopi(8) getint(p);
+                    if(actor == shooter && shothits.find(target) < 0) shothits.add(target);
+                    break;
+                }
+
+                case N_SHOTFX:
+                {
+                    int cn = getint(p), atk = getint(p), id = getint(p);
+                    getint(p);
+                    ivec from, to;
+                    loopk(3) from[k] = getint(p);
+                    loopk(3) to[k] = getint(p);
+                    if(p.overread()) return;
+                    if(cn == shooter) shoot(cn, atk, id, from, to);
+                    shooter = -1;
+                    break;
+                }
+
+                default:
+                    if(!skipmsg(p, type)) return;
+                    break;
+            }
+            if(p.overread()) return;
+        }
+    }
+
+    // sets up the match from the keyframe playback would start from: its map and mode, then its players
+    bool keyframe(ucharbuf &p)
+    {
+        string map;
+        char text[MAXTRANS];
+        bool changed = false;
+        while(p.remaining())
+        {
+            int type = getint(p);
+            switch(type)
+            {
+                case N_WELCOME: break;
+
+                case N_MAPCHANGE:
+                {
+                    getstring(map, p, sizeof(map));
+                    int mode = getint(p), muts = getint(p);
+                    getint(p);
+                    getint(p);
+                    if(p.overread() || !m_mp(mode)) return false;
+                    changemap(map, mode, muts);
+                    changed = true;
+                    break;
+                }
+
+                case N_ITEMLIST:
+                    while(getint(p) >= 0 && !p.overread()) getint(p);
+                    break;
+
+                case N_CURRENTMASTER:
+                    getint(p);
+                    while(getint(p) >= 0 && !p.overread()) getint(p);
+                    break;
+
+                case N_PAUSEGAME:
+                case N_GAMESPEED:
+                case N_TIMEUP:
+                    getint(p);
+                    getint(p);
+                    break;
+
+                case N_TEAMINFO:
+                    loopi(MAXTEAMS) getint(p);
+                    break;
+
+                case N_RESUME:
+                    while(getint(p) >= 0 && !p.overread()) loopi(8 + 5 + NUMGUNS) getint(p);
+                    break;
+
+                case N_INITCLIENT:
+                {
+                    int cn = getint(p);
+                    getint(p);
+                    string name;
+                    getstring(name, p, sizeof(name));
+                    getint(p);
+                    int model = getint(p), color = getint(p);
+                    getstring(text, p);
+                    getstring(text, p);
+                    if(!p.overread()) join(cn, name, model, color);
+                    break;
+                }
+
+                case N_INITAI:
+                    loopi(7) getint(p);
+                    getstring(text, p);
+                    break;
+
+                // mode state follows the players and is rebuilt by the server itself
+                default: return changed;
+            }
+            if(p.overread()) return changed;
+        }
+        return changed;
+    }
+
+    static const char *msgname(int type)
+    {
+        switch(type)
+        {
+            case N_CONNECT: return "connect";
+            case N_POS: return "pos";
+            case N_SHOOT: return "shoot";
+            case N_TRYSPAWN: return "tryspawn";
+            case N_SPAWN: return "spawn";
+            case N_GUNSELECT: return "gunselect";
+            case N_SOUND: return "sound";
+            case N_TAUNT: return "taunt";
+            case N_TELEPORT: return "teleport";
+            case N_JUMPPAD: return "jumppad";
+            case N_SWITCHNAME: return "switchname";
+            case N_CLIENTPING: return "clientping";
+            default: return NULL;
+        }
+    }
+
+    void report(const char *name, int records, ullong elapsed)
+    {
+        static vector<int> order;
+        order.setsize(0);
+        int packets = 0;
+        ullong parsenanos = 0;
+        loopi(NUMMSG) if(stats[i].count)
+        {
+            order.add(i);
+            packets += stats[i].count;
+            parsenanos += stats[i].nanos;
+        }
+        loopv(order) for(int j = i; j > 0 && stats[order[j]].nanos > stats[order[j-1]].nanos; j--) swap(order[j], order[j-1]);
+        conoutf("replaybench: %s: %d records, %d players, %.1f s of match in %.3f ms", name, records, joins, replaymillis/1000.0f, elapsed/1e6);
+        conoutf("replaybench: %d packets parsed in %.3f ms, %d ticks in %.3f ms (%.3f us mean, %.3f us max)",
+            packets, parsenanos/1e6, ticks, ticknanos/1e6, ticks ? ticknanos/1e3/ticks : 0.0, maxticknanos/1e3);
+        loopv(order)
+        {
+            replaystat &s = stats[order[i]];
+            const char *type = msgname(order[i]);
+            defformatstring(label, "%d", order[i]);
+            conoutf("replaybench: %-12s %7d packets %9.1f ns/packet %7.1f bytes/packet", type ? type : label, s.count, double(s.nanos)/s.count, double(s.bytes)/s.count);
+        }
+    }
+};
+
+static void replaybench(const char *name)
+{
+    if(clients.length() || demorecord || demoplayback)
+    {
+        conoutf(CON_ERROR, "replaybench needs an empty server that is not recording or playing a demo");
+        return;
+    }
+    demoheader hdr;
+    demoreader r;
+    if(!openbenchdemo(name, r, hdr)) return;
+    if(hdr.protocol != PROTOCOL_VERSION)
+    {
+        conoutf(CON_ERROR, "demo \"%s\" was recorded with protocol %d", name, hdr.protocol);
+        return;
+    }
+    int oldcurtime = curtime, oldlastmillis = lastmillis, oldtotalmillis = totalmillis, oldmaxclients = maxclients;
+    bool oldnextmatch = demonextmatch;
+    demonextmatch = false;
+    maxclients = MAXCLIENTS;
+    demoreplay *replay = new demoreplay;
+    vector<uchar> data;
+    int stamp[3], records = 0;
+    bool started = false;
+    ullong start = getservernanos();
+    while(r.read(stamp, sizeof(stamp)) == sizeof(stamp))
+    {
+        lilswap(stamp, 3);
+        if(stamp[2] < 0) break;
+        data.setsize(0);
+        if(r.read(data.pad(stamp[2]), stamp[2]) != size_t(stamp[2])) break;
+        records++;
+        ucharbuf p(data.getbuf(), data.length());
+        if(stamp[1] == DEMO_KEYFRAME)
+        {
+            if(started) continue;
+            if(!replay->keyframe(p)) break;
+            replay->replaymillis = stamp[0];
+            started = true;
+            continue;
+        }
+        if(!started) continue;
+        replay->advance(stamp[0]);
+        if(stamp[1] == 0) replay->positions(p);
+        else replay->messages(p);
+    }
+    ullong elapsed = getservernanos() - start;
+    disconnectvirtualclients();
+    if(started) replay->report(name, records, elapsed);
+    else conoutf(CON_ERROR, "demo \"%s\" has no keyframe to start a replay from", name);
+    delete replay;
+    curtime = oldcurtime;
+    lastmillis = oldlastmillis;
+    totalmillis = oldtotalmillis;
+    maxclients = oldmaxclients;
+    demonextmatch = oldnextmatch;
+}
+ICOMMAND(replaybench, "s", (char *name), replaybench(name));
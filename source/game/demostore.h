@@ -0,0 +1,686 @@
+// demo store: recordings are compressed by a writer thread into files under the demo directory,
+// which are kept within a count and size budget by evicting the least recently used,
+// and read back a block at a time so that playback can seek to any keyframe
+
+#define DEMOCHUNKSIZE (64*1024)
+#define DEMOQUEUESIZE 256
+
+VAR(maxdemos, 0, 5, 25);
+VAR(maxdemosize, 0, 16, 31);
+VAR(demostoresize, 0, 256, 65536);
+VAR(demokeyframe, 1, 30, 300);
+SVAR(demostore, "recorded");
+SVARP(demodir, "demo");
+
+const char *getdemofile(const char *file, bool init)
+{
+    if(!demodir[0]) return NULL;
+    static string buf;
+    copystring(buf, demodir);
+    int dirlen = strlen(buf);
+    if(buf[dirlen] != '/' && buf[dirlen] != '\\' && dirlen+1 < (int)sizeof(buf)) { buf[dirlen++] = '/'; buf[dirlen] = '\0'; }
+    if(init)
+    {
+        const char *dir = findfile(buf, "w");
+        if(!fileexists(dir, "w")) createdir(dir);
+    }
+    concatstring(buf, file);
+    return buf;
+}
+
+struct demofile
+{
+    string info, name;
+    int len, lastused;
+};
+
+vector<demofile> demos;
+
+enum { DEMOJOB_OPEN = 0, DEMOJOB_BLOCK, DEMOJOB_DATA, DEMOJOB_CLOSE, DEMOJOB_ABORT };
+
+// file names are resolved by the server loop, so the writer never touches the shared path buffers
+struct demojob
+{
+    int type, id, millis, len, size;
+    uchar *data;
+    stream *file;
+    char *path, *name, *desc;
+    bool ok;
+};
+
+struct demowriter
+{
+    threadhandle thread;
+    semaphore wakeup;
+    spscqueue<demojob, DEMOQUEUESIZE> pending, done;
+    int writing, written, quit;
+
+    // only touched by the writer thread
+    stream *file;
+    string tmpname;
+    vector<uchar> block, packed;
+    vector<demoindex> index;
+    int blockmillis;
+
+    demowriter() : writing(0), written(0), quit(0), file(NULL), blockmillis(0) { tmpname[0] = '\0'; }
+    ~demowriter() { stop(); }
+
+    // jobs queued before stopping are still written, but an unfinished recording is discarded, as it would be by a crash
+    void stop()
+    {
+        if(!thread.running) return;
+        atomicstore(quit, 1);
+        wakeup.post();
+        thread.join();
+    }
+
+    bool open(stream *f, const char *name)
+    {
+        file = f;
+        copystring(tmpname, name);
+        block.setsize(0);
+        index.setsize(0);
+        demoheader hdr;
+        memcpy(hdr.magic, DEMO_MAGIC, sizeof(hdr.magic));
+        hdr.version = DEMO_VERSION;
+        hdr.protocol = PROTOCOL_VERSION;
+        lilswap(&hdr.version, 2);
+        return file->write(&hdr, sizeof(hdr)) == sizeof(hdr);
+    }
+
+    bool writeblock()
+    {
+        if(block.empty()) return true;
+        uLongf packedlen = compressBound(block.length());
+        packed.setsize(0);
+        packed.pad(int(packedlen));
+        if(compress2(packed.getbuf(), &packedlen, block.getbuf(), block.length(), Z_BEST_COMPRESSION) != Z_OK) return false;
+        demoindex &idx = index.add();
+        idx.millis = blockmillis;
+        idx.offset = int(file->tell());
+        demoblock hdr = { blockmillis, block.length(), int(packedlen) };
+        lilswap(&hdr.millis, 3);
+        block.setsize(0);
+        bool ok = file->write(&hdr, sizeof(hdr)) == sizeof(hdr) && file->write(packed.getbuf(), packedlen) == packedlen;
+        atomicstore(written, int(file->tell()));
+        return ok;
+    }
+
+    bool writeindex()
+    {
+        demofooter footer;
+        footer.numblocks = index.length();
+        footer.offset = int(file->tell());
+        memcpy(footer.magic, DEMO_INDEXMAGIC, sizeof(footer.magic));
+        lilswap(&footer.numblocks, 2);
+        loopv(index) lilswap(&index[i].millis, 2);
+        return file->write(index.getbuf(), index.length()*sizeof(demoindex)) == index.length()*sizeof(demoindex) &&
+               file->write(&footer, sizeof(footer)) == sizeof(footer);
+    }
+
+    // finishes the recording in progress, which is kept only when a close asks for it
+    void close(demojob &job)
+    {
+        bool ok = job.type == DEMOJOB_CLOSE && writeblock() && writeindex();
+        job.size = int(file->size());
+        DELETEP(file);
+        if(ok) ok = !rename(tmpname, job.path);
+        if(!ok) remove(tmpname);
+        if(job.type == DEMOJOB_CLOSE) job.ok = ok;
+    }
+
+    static int run(void *data)
+    {
+        demowriter &w = *(demowriter *)data;
+        for(;;)
+        {
+            w.wakeup.wait();
+            demojob job;
+            if(!w.pending.pop(job))
+            {
+                if(!atomicload(w.quit)) continue;
+                if(w.file)
+                {
+                    DELETEP(w.file);
+                    remove(w.tmpname);
+                }
+                break;
+            }
+            if((job.type == DEMOJOB_OPEN || job.type == DEMOJOB_CLOSE || job.type == DEMOJOB_ABORT) && w.file) w.close(job);
+            switch(job.type)
+            {
+                case DEMOJOB_OPEN:
+                    job.ok = w.open(job.file, job.path);
+                    atomicstore(w.written, 0);
+                    atomicstore(w.writing, job.id);
+                    break;
+
+                case DEMOJOB_BLOCK:
+                    if(w.file)
+                    {
+                        job.ok = w.writeblock();
+                        w.blockmillis = job.millis;
+                    }
+                    break;
+
+                case DEMOJOB_DATA:
+                    if(w.file)
+                    {
+                        w.block.put(job.data, job.len);
+                        job.ok = true;
+                    }
+                    break;
+            }
+            // the server loop never has more jobs in flight than the queue holds, so this cannot fail
+            w.done.push(job);
+        }
+        return 0;
+    }
+};
+
+demowriter demowrite;
+int demojobs = 0, demoid = 0, demochunklen = 0;
+uchar *demochunk = NULL;
+vector<uchar *> demochunks;
+bool demorecord = false;
+int demoblockmillis = 0;
+
+static demojob &newdemojob(int type)
+{
+    static demojob job;
+    memset(&job, 0, sizeof(job));
+    job.type = type;
+    job.id = demoid;
+    return job;
+}
+
+static bool queuedemojob(demojob &job)
+{
+    if(demojobs >= DEMOQUEUESIZE-1 || !demowrite.thread.start(demowriter::run, &demowrite) || !demowrite.pending.push(job)) return false;
+    demojobs++;
+    demowrite.wakeup.post();
+    return true;
+}
+
+static bool flushdemochunk()
+{
+    if(!demochunk || !demochunklen) return true;
+    demojob &job = newdemojob(DEMOJOB_DATA);
+    job.data = demochunk;
+    job.len = demochunklen;
+    if(!queuedemojob(job)) return false;
+    demochunk = NULL;
+    demochunklen = 0;
+    return true;
+}
+
+static const char *demostorefile(const char *name, const char *ext)
+{
+    defformatstring(file, "%s/%s.%s", demostore, name, ext);
+    return getdemofile(file, false);
+}
+
+// resolves a stored file to the path the C library calls operate on
+static const char *demostorepath(const char *name, const char *ext)
+{
+    const char *file = demostorefile(name, ext);
+    return file ? findfile(file, "w") : NULL;
+}
+
+static llong demostorebytes()
+{
+    llong total = 0;
+    loopv(demos) total += demos[i].len;
+    return total;
+}
+
+// evicts the least recently used demos until extra more, of extrasize bytes, fit within maxdemos and demostoresize
+void prunedemos(int extra = 0, int extrasize = 0)
+{
+    llong budget = llong(demostoresize)<<20, size = demostorebytes() + extrasize;
+    while(demos.length() && (demos.length() + extra > maxdemos || (demostoresize && size > budget)))
+    {
+        int oldest = 0;
+        loopv(demos) if(demos[i].lastused < demos[oldest].lastused) oldest = i;
+        size -= demos[oldest].len;
+        const char *file = demostorepath(demos[oldest].name, "dmo");
+        if(file) remove(file);
+        demos.remove(oldest);
+    }
+}
+
+static void formatdemoinfo(demofile &d, const char *desc)
+{
+    int len = d.len;
+    formatstring(d.info, "%s, %.2f%s", desc, len > 1024*1024 ? len/(1024*1024.f) : len/1024.0f, len > 1024*1024 ? "MB" : "kB");
+}
+
+static void adddemo(const char *name, const char *desc, int len)
+{
+    prunedemos(1, len);
+    demofile &d = demos.add();
+    copystring(d.name, name);
+    d.len = len;
+    d.lastused = totalmillis;
+    formatdemoinfo(d, desc);
+    sendservmsgf("demo \"%s\" recorded", d.info);
+}
+
+static const char *demostoredir(bool init)
+{
+    if(!demodir[0] || !demostore[0]) return NULL;
+    defformatstring(dir, "%s/", demostore);
+    const char *path = getdemofile(dir, init);
+    if(!path) return NULL;
+    path = findfile(path, "w");
+    if(init && !fileexists(path, "w")) createdir(path);
+    return path;
+}
+
+// instances that share a store tell their files apart by the port they serve on, which stays the same across restarts
+static const char *demostoreprefix()
+{
+    static string prefix;
+    formatstring(prefix, "%d_", getvar("serverport"));
+    return prefix;
+}
+
+static bool owndemofile(const char *name)
+{
+    const char *prefix = demostoreprefix();
+    return !strncmp(name, prefix, strlen(prefix));
+}
+
+// takes over this instance's demos left in the store by a previous run, and removes its recordings that never finished
+void loaddemostore()
+{
+    demos.setsize(0);
+    const char *dir = demostoredir(false);
+    if(!dir) return;
+    string path;
+    copystring(path, dir);
+    vector<char *> files;
+    listdir(path, false, "tmp", files);
+    loopv(files) if(owndemofile(files[i])) if(const char *file = demostorepath(files[i], "tmp")) remove(file);
+    files.deletearrays();
+    listdir(path, false, "dmo", files);
+    files.sort();
+    loopv(files)
+    {
+        if(!owndemofile(files[i])) continue;
+        const char *file = demostorefile(files[i], "dmo");
+        stream *f = file ? openrawfile(file, "rb") : NULL;
+        if(!f) continue;
+        demofile &d = demos.add();
+        copystring(d.name, files[i]);
+        d.len = int(f->size());
+        d.lastused = i - files.length();
+        formatdemoinfo(d, files[i] + strlen(demostoreprefix()));
+        delete f;
+    }
+    files.deletearrays();
+    prunedemos();
+}
+
+static bool demoexists(const char *name)
+{
+    loopv(demos) if(!strcmp(demos[i].name, name)) return true;
+    const char *file = demostorepath(name, "dmo");
+    return file && fileexists(file, "r");
+}
+
+void enddemorecord()
+{
+    if(!demorecord) return;
+    demorecord = false;
+
+    bool keep = maxdemos && maxdemosize && flushdemochunk();
+    demojob &job = newdemojob(keep ? DEMOJOB_CLOSE : DEMOJOB_ABORT);
+    if(keep)
+    {
+        time_t t = time(NULL);
+        char *timestr = ctime(&t), *trim = timestr + strlen(timestr);
+        while(trim>timestr && iscubespace(*--trim)) *trim = '\0';
+        string name;
+        copystring(name, demostoreprefix());
+        int prefixlen = strlen(name);
+        strftime(&name[prefixlen], sizeof(name)-prefixlen, "%Y%m%d_%H%M%S_", localtime(&t));
+        concatstring(name, modename(gamemode));
+        concatstring(name, "_");
+        concatstring(name, smapname);
+        for(char *s = name; *s; s++) if(!isalnum(uchar(*s)) && *s != '_' && *s != '-') *s = '-';
+        int namelen = strlen(name);
+        for(int n = 2; demoexists(name); n++) nformatstring(&name[namelen], sizeof(name)-namelen, "_%d", n);
+        const char *path = demostorepath(name, "dmo");
+        defformatstring(desc, "%s: %s, %s", timestr, modeprettyname(gamemode), smapname);
+        job.path = newstring(path ? path : "");
+        job.name = newstring(name);
+        job.desc = newstring(desc);
+    }
+    if(!queuedemojob(job))
+    {
+        // the writer is backed up; the unfinished recording is dropped when the next one opens
+        DELETEA(job.path);
+        DELETEA(job.name);
+        DELETEA(job.desc);
+        if(keep) sendservmsg("could not save demo");
+    }
+}
+
+// makes room for len bytes of the recording, stopping it if the writer has fallen too far behind
+static uchar *reservedemo(int len)
+{
+    if(demochunklen + len > DEMOCHUNKSIZE && !flushdemochunk())
+    {
+        conoutf(CON_WARN, "demo writer fell behind, stopping recording");
+        enddemorecord();
+        return NULL;
+    }
+    if(!demochunk)
+    {
+        // oversized records get a chunk of their own that is freed rather than recycled
+        if(len > DEMOCHUNKSIZE) demochunk = new uchar[len];
+        else demochunk = demochunks.length() ? demochunks.pop() : new uchar[DEMOCHUNKSIZE];
+    }
+    uchar *buf = &demochunk[demochunklen];
+    demochunklen += len;
+    return buf;
+}
+
+static bool writedemorecord(int chan, const void *data, int len)
+{
+    int stamp[3] = { gamemillis, chan, len };
+    lilswap(stamp, 3);
+    uchar *buf = reservedemo(sizeof(stamp) + len);
+    if(!buf) return false;
+    memcpy(buf, stamp, sizeof(stamp));
+    memcpy(buf + sizeof(stamp), data, len);
+    if(demochunklen > DEMOCHUNKSIZE) flushdemochunk();
+    return true;
+}
+
+// closes the current block and opens the next with a keyframe, so that playback can start from it
+static void startdemoblock()
+{
+    if(!flushdemochunk())
+    {
+        enddemorecord();
+        return;
+    }
+    demojob &job = newdemojob(DEMOJOB_BLOCK);
+    job.millis = gamemillis;
+    if(!queuedemojob(job))
+    {
+        conoutf(CON_WARN, "demo writer fell behind, stopping recording");
+        enddemorecord();
+        return;
+    }
+    demoblockmillis = gamemillis;
+    packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+    welcomedemopacket(p);
+    writedemorecord(DEMO_KEYFRAME, p.buf, p.len);
+}
+
+void writedemo(int chan, void *data, int len)
+{
+    if(!demorecord) return;
+    if(gamemillis < demoblockmillis || gamemillis - demoblockmillis >= demokeyframe*1000)
+    {
+        startdemoblock();
+        if(!demorecord) return;
+    }
+    if(!writedemorecord(chan, data, len)) return;
+    if(atomicload(demowrite.writing) == demoid && atomicload(demowrite.written) >= (maxdemosize<<20)) enddemorecord();
+}
+
+static bool opendemorecord()
+{
+    if(!demostoredir(true)) return false;
+    defformatstring(tmpname, "%s%d_%d", demostoreprefix(), int(time(NULL)), demoid+1);
+    stream *file = openrawfile(demostorefile(tmpname, "tmp"), "w+b");
+    if(!file) return false;
+    demoid++;
+    demojob &job = newdemojob(DEMOJOB_OPEN);
+    job.file = file;
+    job.path = newstring(demostorepath(tmpname, "tmp"));
+    if(!queuedemojob(job))
+    {
+        delete file;
+        delete[] job.path;
+        return false;
+    }
+    demochunklen = 0;
+    return true;
+}
+
+// collects finished jobs from the writer: recycles chunks and registers completed demos
+void checkdemowriter()
+{
+    demojob job;
+    while(demowrite.done.pop(job))
+    {
+        demojobs--;
+        switch(job.type)
+        {
+            case DEMOJOB_OPEN:
+            case DEMOJOB_BLOCK:
+                if(!job.ok) conoutf(CON_ERROR, "could not write demo");
+                break;
+
+            case DEMOJOB_DATA:
+                if(!job.ok) conoutf(CON_ERROR, "could not write demo");
+                if(job.len > DEMOCHUNKSIZE || demochunks.length() >= DEMOQUEUESIZE/4) delete[] job.data;
+                else demochunks.add(job.data);
+                break;
+
+            case DEMOJOB_CLOSE:
+                if(job.ok) adddemo(job.name, job.desc, job.size);
+                else sendservmsg("could not save demo");
+                break;
+        }
+        DELETEA(job.path);
+        DELETEA(job.name);
+        DELETEA(job.desc);
+    }
+}
+
+// plays back a recording: current demos are read a block at a time through their index,
+// older ones straight through as a single compressed stream
+struct demoreader : stream
+{
+    stream *file, *legacy;
+    vector<demoindex> index;
+    vector<uchar> block, packed;
+    int curblock, pos;
+    bool keyframe;
+
+    demoreader() : file(NULL), legacy(NULL), curblock(-1), pos(0), keyframe(true) {}
+    ~demoreader() { close(); }
+
+    void close()
+    {
+        DELETEP(legacy);
+        DELETEP(file);
+    }
+
+    bool end() { return legacy ? legacy->end() : curblock+1 >= index.length() && pos >= block.length(); }
+    bool seekable() const { return !legacy && index.length() > 0; }
+
+    // takes ownership of f, returning false if it does not hold a demo
+    bool open(stream *f, demoheader &hdr)
+    {
+        file = f;
+        if(file->read(&hdr, sizeof(hdr)) == sizeof(hdr) && !memcmp(hdr.magic, DEMO_MAGIC, sizeof(hdr.magic)))
+        {
+            lilswap(&hdr.version, 2);
+            if(hdr.version == DEMO_VERSION) loadindex();
+            return true;
+        }
+        // version 1 demos were compressed as a whole, header included
+        if(!file->seek(0)) return false;
+        legacy = opengzfile(NULL, "rb", file);
+        if(!legacy || legacy->read(&hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr.magic, DEMO_MAGIC, sizeof(hdr.magic))) return false;
+        lilswap(&hdr.version, 2);
+        return true;
+    }
+
+    void loadindex()
+    {
+        stream::offset size = file->size();
+        demofooter footer;
+        if(size >= stream::offset(sizeof(demoheader) + sizeof(footer)) && file->seek(size - sizeof(footer)) &&
+           file->read(&footer, sizeof(footer)) == sizeof(footer) && !memcmp(footer.magic, DEMO_INDEXMAGIC, sizeof(footer.magic)))
+        {
+            lilswap(&footer.numblocks, 2);
+            if(footer.numblocks > 0 && footer.offset >= int(sizeof(demoheader)) &&
+               footer.offset + footer.numblocks*stream::offset(sizeof(demoindex)) == size - stream::offset(sizeof(footer)) &&
+               file->seek(footer.offset))
+            {
+                index.setsize(0);
+                index.pad(footer.numblocks);
+                if(file->read(index.getbuf(), index.length()*sizeof(demoindex)) == index.length()*sizeof(demoindex))
+                {
+                    lilswap(&index[0].millis, 2*index.length());
+                    return;
+                }
+            }
+        }
+        // without an intact index the blocks are found by walking their headers
+        index.setsize(0);
+        for(stream::offset offset = sizeof(demoheader); file->seek(offset);)
+        {
+            demoblock b;
+            if(file->read(&b, sizeof(b)) != sizeof(b)) break;
+            lilswap(&b.millis, 3);
+            if(b.rawlen <= 0 || b.packedlen <= 0 || offset + stream::offset(sizeof(b)) + b.packedlen > size) break;
+            demoindex &idx = index.add();
+            idx.millis = b.millis;
+            idx.offset = int(offset);
+            offset += sizeof(b) + b.packedlen;
+        }
+    }
+
+    bool loadblock(int n)
+    {
+        if(!index.inrange(n)) return false;
+        demoblock b;
+        if(!file->seek(index[n].offset) || file->read(&b, sizeof(b)) != sizeof(b)) return false;
+        lilswap(&b.millis, 3);
+        if(b.rawlen <= 0 || b.packedlen <= 0) return false;
+        packed.setsize(0);
+        packed.pad(b.packedlen);
+        block.setsize(0);
+        block.pad(b.rawlen);
+        uLongf rawlen = b.rawlen;
+        if(file->read(packed.getbuf(), b.packedlen) != size_t(b.packedlen) ||
+           uncompress(block.getbuf(), &rawlen, packed.getbuf(), b.packedlen) != Z_OK || rawlen != uLongf(b.rawlen))
+            return false;
+        curblock = n;
+        pos = 0;
+        return true;
+    }
+
+    // the block whose keyframe is the latest one at or before millis
+    int findblock(int millis) const
+    {
+        int lo = 0, hi = index.length()-1;
+        while(lo < hi)
+        {
+            int mid = (lo + hi + 1)/2;
+            if(index[mid].millis <= millis) lo = mid;
+            else hi = mid-1;
+        }
+        return lo;
+    }
+
+    bool skip(int len)
+    {
+        if(legacy)
+        {
+            uchar buf[512];
+            while(len > 0)
+            {
+                int n = min(len, int(sizeof(buf)));
+                if(legacy->read(buf, n) != size_t(n)) return false;
+                len -= n;
+            }
+            return true;
+        }
+        while(len > 0)
+        {
+            if(pos >= block.length() && !loadblock(curblock+1)) return false;
+            int n = min(len, block.length() - pos);
+            pos += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    size_t read(void *buf, size_t len)
+    {
+        if(legacy) return legacy->read(buf, len);
+        size_t got = 0;
+        while(got < len)
+        {
+            if(pos >= block.length() && !loadblock(curblock+1)) break;
+            int n = min(int(len - got), block.length() - pos);
+            memcpy((uchar *)buf + got, &block[pos], n);
+            pos += n;
+            got += n;
+        }
+        return got;
+    }
+};
+
+// opens a demo for the benchmarks, looking in the demo directory before the given path
+static bool openbenchdemo(const char *name, demoreader &r, demoheader &hdr)
+{
+    string file;
+    copystring(file, name);
+    int namelen = strlen(file);
+    if(namelen < 4 || strcasecmp(&file[namelen-4], ".dmo")) concatstring(file, ".dmo");
+    stream *f = NULL;
+    if(const char *buf = getdemofile(file, false)) f = openfile(buf, "rb");
+    if(!f) f = openfile(file, "rb");
+    if(!f || !r.open(f, hdr))
+    {
+        conoutf(CON_ERROR, "could not read demo \"%s\"", file);
+        return false;
+    }
+    return true;
+}
+
+// replays the traffic of a recorded demo through the network compressor, grouping the records of each moment into datagrams
+static void compressbench(const char *name)
+{
+    demoheader hdr;
+    demoreader r;
+    if(!openbenchdemo(name, r, hdr)) return;
+    int mtu = getservermtu() > 0 ? getservermtu() : ENET_HOST_DEFAULT_MTU, millis = -1, cur = 0, stamp[3];
+    vector<uchar> data;
+    vector<int> datagrams;
+    while(r.read(stamp, sizeof(stamp)) == sizeof(stamp))
+    {
+        lilswap(stamp, 3);
+        if(stamp[2] < 0) break;
+        // only the keyframe playback starts from was ever sent, as the welcome packet
+        bool skip = stamp[1] == DEMO_KEYFRAME && !r.keyframe;
+        r.keyframe = false;
+        if(skip)
+        {
+            if(!r.skip(stamp[2])) break;
+            continue;
+        }
+        if(stamp[0] != millis && cur)
+        {
+            datagrams.add(cur);
+            cur = 0;
+        }
+        millis = stamp[0];
+        if(r.read(data.pad(stamp[2]), stamp[2]) != size_t(stamp[2])) break;
+        for(cur += stamp[2]; cur >= mtu; cur -= mtu) datagrams.add(mtu);
+    }
+    if(cur) datagrams.add(cur);
+    netcompressbench(data, datagrams);
+}
+ICOMMAND(compressbench, "s", (char *name), compressbench(name));
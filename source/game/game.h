@@ -125,6 +125,7 @@ enum
     N_SERVCMD,
     N_DEMOPACKET,
     N_COUNTRY,
+    N_POSDELTA, N_POSACK,
     NUMMSG
 };
 
@@ -156,15 +157,18 @@ static const int msgsizes[] =               // size inclusive message token, 0 f
     N_SERVCMD, 0,
     N_DEMOPACKET, 0,
     N_COUNTRY, 0,
+    N_POSDELTA, 0, N_POSACK, 2,
     -1
 };
 
 #define VALHALLA_SERVER_PORT 21217
 #define VALHALLA_LANINFO_PORT 21216
 #define VALHALLA_MASTER_PORT 21215
-#define PROTOCOL_VERSION 2 // bump when protocol changes
-#define DEMO_VERSION 1  // bump when demo format changes
+#define PROTOCOL_VERSION 3 // bump when protocol changes
+#define DEMO_VERSION 2  // bump when demo format changes
 #define DEMO_MAGIC "VALHALLA_DEMO\0\0"
+#define DEMO_INDEXMAGIC "VALHALLA_INDEX\0"
+#define DEMO_KEYFRAME -1 // channel of the full game state record that starts every block
 
 struct demoheader
 {
@@ -172,6 +176,149 @@ struct demoheader
     int version, protocol;
 };
 
+// since version 2 the header is followed by separately compressed blocks of records and an index of where each starts
+struct demoblock
+{
+    int millis, rawlen, packedlen;
+};
+
+struct demoindex
+{
+    int millis, offset;
+};
+
+struct demofooter
+{
+    int numblocks, offset;
+    char magic[16];
+};
+
+enum
+{
+    POS_PHYSSTATE = 0, POS_FLAGS, POS_X, POS_Y, POS_Z, POS_DIR, POS_ROLL, POS_VEL, POS_VELDIR, POS_FALL, POS_FALLDIR,
+    NUMPOSFIELDS
+};
+
+#define POSFRAMES 32 // number of sent position frames that can serve as a delta baseline
+
+// decoded N_POS update, the unit of N_POSDELTA compression
+struct posstate
+{
+    int cn, vals[NUMPOSFIELDS];
+
+    void reset(int n = -1)
+    {
+        cn = n;
+        memset(vals, 0, sizeof(vals));
+    }
+
+    // reads the body of an N_POS message, the message type must already be consumed
+    void parse(ucharbuf &p)
+    {
+        cn = getuint(p);
+        vals[POS_PHYSSTATE] = p.get();
+        uint flags = getuint(p);
+        vals[POS_FLAGS] = flags&0xFFFF;
+        loopk(3)
+        {
+            int n = p.get(); n |= p.get()<<8; if(flags&(1<<k)) { n |= p.get()<<16; if(n&0x800000) n |= ~0U<<24; }
+            vals[POS_X+k] = n;
+        }
+        int dir = p.get(); dir |= p.get()<<8;
+        vals[POS_DIR] = dir;
+        vals[POS_ROLL] = p.get();
+        int mag = p.get(); if(flags&(1<<3)) mag |= p.get()<<8;
+        vals[POS_VEL] = mag;
+        dir = p.get(); dir |= p.get()<<8;
+        vals[POS_VELDIR] = dir;
+        vals[POS_FALL] = vals[POS_FALLDIR] = 0;
+        if(flags&(1<<4))
+        {
+            mag = p.get(); if(flags&(1<<5)) mag |= p.get()<<8;
+            vals[POS_FALL] = mag;
+            if(flags&(1<<6)) { dir = p.get(); dir |= p.get()<<8; vals[POS_FALLDIR] = dir; }
+        }
+    }
+
+    // field deltas are zigzag coded with a 1-3 bit prefix selecting a 5, 10, 16 or 26 bit payload
+    template<class T>
+    static void putdeltaval(bitbuf<T> &b, int v)
+    {
+        uint z = (uint(v)<<1) ^ uint(v>>31);
+        if(z < (1<<5)) { b.putbits(0, 1); b.putbits(z, 5); }
+        else if(z < (1<<10)) { b.putbits(1, 2); b.putbits(z, 10); }
+        else if(z < (1<<16)) { b.putbits(3, 3); b.putbits(z, 16); }
+        else { b.putbits(7, 3); b.putbits(z, 26); }
+    }
+
+    template<class T>
+    static int getdeltaval(bitbuf<T> &b)
+    {
+        uint z;
+        if(!b.getbits(1)) z = b.getbits(5);
+        else if(!b.getbits(1)) z = b.getbits(10);
+        else if(!b.getbits(1)) z = b.getbits(16);
+        else z = b.getbits(26);
+        return int(z>>1) ^ -int(z&1);
+    }
+
+    template<class T>
+    static void putdeltacn(bitbuf<T> &b, int cn) { b.putbits(cn, 8); }
+
+    // names the frame holding the baseline of a state: 0 for the frame the receiver last acknowledged,
+    // n for the one n frames before that, and -1 for none
+    template<class T>
+    static void putdeltabase(bitbuf<T> &b, int age)
+    {
+        if(!age) b.putbits(0, 1);
+        else { b.putbits(1, 1); putdeltaval(b, age); }
+    }
+
+    template<class T>
+    static int getdeltabase(bitbuf<T> &b) { return b.getbits(1) ? getdeltaval(b) : 0; }
+
+    // writes this state relative to base, which must be a reset state if the receiver has no baseline for cn
+    template<class T>
+    void putdelta(bitbuf<T> &b, const posstate &base) const
+    {
+        uint mask = 0;
+        loopi(NUMPOSFIELDS) if(vals[i] != base.vals[i]) mask |= 1<<i;
+        b.putbits(mask, NUMPOSFIELDS);
+        loopi(NUMPOSFIELDS) if(mask&(1<<i)) putdeltaval(b, vals[i] - base.vals[i]);
+    }
+
+    template<class T>
+    static int getdeltacn(bitbuf<T> &b) { return b.getbits(8); }
+
+    template<class T>
+    void getdelta(bitbuf<T> &b, const posstate &base)
+    {
+        uint mask = b.getbits(NUMPOSFIELDS);
+        loopi(NUMPOSFIELDS) vals[i] = mask&(1<<i) ? base.vals[i] + getdeltaval(b) : base.vals[i];
+    }
+};
+
+// the states sent to or received by one client in a single N_POSDELTA, sorted by cn
+struct posframe
+{
+    int seq;
+    vector<posstate> states;
+
+    posframe() : seq(-1) {}
+
+    const posstate *find(int cn) const
+    {
+        int lo = 0, hi = states.length();
+        while(lo < hi)
+        {
+            int mid = (lo + hi)/2;
+            if(states[mid].cn < cn) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo < states.length() && states[lo].cn == cn ? &states[lo] : NULL;
+    }
+};
+
 #include "projectile.h"
 #include "weapon.h"
 #include "ai.h"
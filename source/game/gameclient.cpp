@@ -616,7 +616,9 @@ namespace game
         scorelimit = _scorelimit;
         if(editmode) toggleedit();
         if(m_demo) { entities::resetspawns(); return; }
-        if((m_edit && !name[0]) || !load_world(name))
+        // keyframes of a demo repeat the map change, which should not reload the map being played
+        bool reload = !demoplayback || !name[0] || strcmp(name, getclientmap());
+        if(reload && ((m_edit && !name[0]) || !load_world(name)))
         {
             emptymap(0, true, name);
             senditemstoserver = false;
@@ -1032,6 +1034,29 @@ namespace game
         memset(connectpass, 0, sizeof(connectpass));
     }
 
+    VARP(posdelta, 0, 1, 1);
+
+    posframe posframes[POSFRAMES];
+    int posack = -1, sentposack = -2;
+
+    void resetposdelta()
+    {
+        loopi(POSFRAMES) { posframes[i].seq = -1; posframes[i].states.setsize(0); }
+        posack = -1;
+        sentposack = -2;
+    }
+
+    // demo being downloaded, which the server sends as a sequence of chunks
+    static stream *demorecv = NULL;
+    static int demorecvtag = -1;
+    static string demorecvname = "";
+
+    void cleardemorecv()
+    {
+        DELETEP(demorecv);
+        demorecvtag = -1;
+    }
+
     void gameconnect(bool _remote)
     {
         remote = _remote;
@@ -1051,6 +1076,8 @@ namespace game
         mastermode = MM_OPEN;
         messages.setsize(0);
         messagereliable = false;
+        resetposdelta();
+        cleardemorecv();
         messagecn = -1;
         self->respawn();
         self->lifesequence = 0;
@@ -1246,6 +1273,33 @@ namespace game
             putint(p, totalmillis);
             lastping = totalmillis;
         }
+        if(connected)
+        {
+            if(!posdelta)
+            {
+                if(sentposack != -2)
+                {
+                    p.reliable();
+                    putint(p, N_POSACK);
+                    putint(p, -2);
+                    resetposdelta();
+                }
+            }
+            else if(sentposack == -2)
+            {
+                resetposdelta();
+                p.reliable();
+                putint(p, N_POSACK);
+                putint(p, -1);
+                sentposack = -1;
+            }
+            else if(posack > sentposack)
+            {
+                putint(p, N_POSACK);
+                putint(p, posack);
+                sentposack = posack;
+            }
+        }
         sendclientpacket(p.finalize(), 1);
     }
 
@@ -1314,6 +1368,110 @@ namespace game
         }
     }
 
+    void applyposition(const posstate &ps)
+    {
+        int physstate = ps.vals[POS_PHYSSTATE], flags = ps.vals[POS_FLAGS];
+        vec o, vel, falling;
+        float yaw, pitch, roll;
+        loopk(3) o[k] = ps.vals[POS_X+k]/DMF;
+        int dir = ps.vals[POS_DIR];
+        yaw = dir%360;
+        pitch = clamp(dir/360, 0, 180)-90;
+        roll = clamp(ps.vals[POS_ROLL], 0, 180)-90;
+        dir = ps.vals[POS_VELDIR];
+        vecfromyawpitch(dir%360, clamp(dir/360, 0, 180)-90, 1, 0, vel);
+        vel.mul(ps.vals[POS_VEL]/DVELF);
+        if(flags&(1<<4))
+        {
+            if(flags&(1<<6))
+            {
+                dir = ps.vals[POS_FALLDIR];
+                vecfromyawpitch(dir%360, clamp(dir/360, 0, 180)-90, 1, 0, falling);
+            }
+            else falling = vec(0, 0, -1);
+            falling.mul(ps.vals[POS_FALL]/DVELF);
+        }
+        else falling = vec(0, 0, 0);
+        int seqcolor = (physstate>>3)&1;
+        gameent *d = getclient(ps.cn);
+        if(!d || d->lifesequence < 0 || seqcolor!=(d->lifesequence&1) || d->state==CS_DEAD) return;
+        float oldyaw = d->yaw, oldpitch = d->pitch, oldroll = d->roll;
+        d->yaw = yaw;
+        d->pitch = pitch;
+        d->roll = roll;
+        d->move = (physstate>>4)&2 ? -1 : (physstate>>4)&1;
+        d->strafe = (physstate>>6)&2 ? -1 : (physstate>>6)&1;
+        d->crouching = (flags&(1<<8))!=0 ? -1 : abs(d->crouching);
+        vec oldpos(d->o);
+        d->o = o;
+        d->o.z += d->eyeheight;
+        d->vel = vel;
+        d->falling = falling;
+        d->physstate = physstate&7;
+        physics::updatephysstate(d);
+        updatepos(d);
+        if(smoothmove && d->smoothmillis>=0 && oldpos.dist(d->o) < smoothdist)
+        {
+            d->newpos = d->o;
+            d->newyaw = d->yaw;
+            d->newpitch = d->pitch;
+            d->newroll = d->roll;
+            d->o = oldpos;
+            d->yaw = oldyaw;
+            d->pitch = oldpitch;
+            d->roll = oldroll;
+            (d->deltapos = oldpos).sub(d->newpos);
+            d->deltayaw = oldyaw - d->newyaw;
+            if(d->deltayaw > 180) d->deltayaw -= 360;
+            else if(d->deltayaw < -180) d->deltayaw += 360;
+            d->deltapitch = oldpitch - d->newpitch;
+            d->deltaroll = oldroll - d->newroll;
+            d->smoothmillis = lastmillis;
+        }
+        else d->smoothmillis = 0;
+        if(d->state==CS_LAGGED || d->state==CS_SPAWNING)
+        {
+            if(d->state == CS_SPAWNING)
+            {
+                spawneffect(d);
+            }
+            d->state = CS_ALIVE;
+        }
+    }
+
+    void parseposdelta(ucharbuf &p)
+    {
+        int seq = getint(p), baseseq = getint(p), count = getuint(p), len = getuint(p);
+        ucharbuf q = p.subbuf(len);
+        if(seq < 0 || baseseq >= seq) return;
+        posframe &frame = posframes[seq%POSFRAMES];
+        frame.seq = -1;
+        frame.states.setsize(0);
+        bitbuf<ucharbuf> b(q);
+        posstate zero;
+        zero.reset();
+        loopi(count)
+        {
+            posstate &ps = frame.states.add();
+            ps.cn = posstate::getdeltacn(b);
+            const posstate *bs = NULL;
+            // each state names its own baseline, the last one of it this client acknowledged
+            int age = baseseq >= 0 ? posstate::getdeltabase(b) : -1;
+            if(age >= 0)
+            {
+                int bseq = baseseq - age;
+                const posframe &base = posframes[bseq%POSFRAMES];
+                // baseline was overwritten, wait for the next frame
+                if(bseq < 0 || seq - bseq >= POSFRAMES || base.seq != bseq || !(bs = base.find(ps.cn))) { frame.states.setsize(0); return; }
+            }
+            ps.getdelta(b, bs ? *bs : zero);
+            if(q.overread()) { frame.states.setsize(0); return; }
+        }
+        frame.seq = seq;
+        if(seq > posack) posack = seq;
+        loopv(frame.states) applyposition(frame.states[i]);
+    }
+
     void parsepositions(ucharbuf &p)
     {
         int type;
@@ -1322,82 +1480,16 @@ namespace game
             case N_DEMOPACKET: break;
             case N_POS:                        // position of another client
             {
-                int cn = getuint(p), physstate = p.get(), flags = getuint(p);
-                vec o, vel, falling;
-                float yaw, pitch, roll;
-                loopk(3)
-                {
-                    int n = p.get(); n |= p.get()<<8; if(flags&(1<<k)) { n |= p.get()<<16; if(n&0x800000) n |= ~0U<<24; }
-                    o[k] = n/DMF;
-                }
-                int dir = p.get(); dir |= p.get()<<8;
-                yaw = dir%360;
-                pitch = clamp(dir/360, 0, 180)-90;
-                roll = clamp(int(p.get()), 0, 180)-90;
-                int mag = p.get(); if(flags&(1<<3)) mag |= p.get()<<8;
-                dir = p.get(); dir |= p.get()<<8;
-                vecfromyawpitch(dir%360, clamp(dir/360, 0, 180)-90, 1, 0, vel);
-                vel.mul(mag/DVELF);
-                if(flags&(1<<4))
-                {
-                    mag = p.get(); if(flags&(1<<5)) mag |= p.get()<<8;
-                    if(flags&(1<<6))
-                    {
-                        dir = p.get(); dir |= p.get()<<8;
-                        vecfromyawpitch(dir%360, clamp(dir/360, 0, 180)-90, 1, 0, falling);
-                    }
-                    else falling = vec(0, 0, -1);
-                    falling.mul(mag/DVELF);
-                }
-                else falling = vec(0, 0, 0);
-                int seqcolor = (physstate>>3)&1;
-                gameent *d = getclient(cn);
-                if(!d || d->lifesequence < 0 || seqcolor!=(d->lifesequence&1) || d->state==CS_DEAD) continue;
-                float oldyaw = d->yaw, oldpitch = d->pitch, oldroll = d->roll;
-                d->yaw = yaw;
-                d->pitch = pitch;
-                d->roll = roll;
-                d->move = (physstate>>4)&2 ? -1 : (physstate>>4)&1;
-                d->strafe = (physstate>>6)&2 ? -1 : (physstate>>6)&1;
-                d->crouching = (flags&(1<<8))!=0 ? -1 : abs(d->crouching);
-                vec oldpos(d->o);
-                d->o = o;
-                d->o.z += d->eyeheight;
-                d->vel = vel;
-                d->falling = falling;
-                d->physstate = physstate&7;
-                physics::updatephysstate(d);
-                updatepos(d);
-                if(smoothmove && d->smoothmillis>=0 && oldpos.dist(d->o) < smoothdist)
-                {
-                    d->newpos = d->o;
-                    d->newyaw = d->yaw;
-                    d->newpitch = d->pitch;
-                    d->newroll = d->roll;
-                    d->o = oldpos;
-                    d->yaw = oldyaw;
-                    d->pitch = oldpitch;
-                    d->roll = oldroll;
-                    (d->deltapos = oldpos).sub(d->newpos);
-                    d->deltayaw = oldyaw - d->newyaw;
-                    if(d->deltayaw > 180) d->deltayaw -= 360;
-                    else if(d->deltayaw < -180) d->deltayaw += 360;
-                    d->deltapitch = oldpitch - d->newpitch;
-                    d->deltaroll = oldroll - d->newroll;
-                    d->smoothmillis = lastmillis;
-                }
-                else d->smoothmillis = 0;
-                if(d->state==CS_LAGGED || d->state==CS_SPAWNING)
-                {
-                    if(d->state == CS_SPAWNING)
-                    {
-                        spawneffect(d);
-                    }
-                    d->state = CS_ALIVE;
-                }
+                posstate ps;
+                ps.parse(p);
+                applyposition(ps);
                 break;
             }
 
+            case N_POSDELTA:
+                parseposdelta(p);
+                break;
+
             case N_TELEPORT:
             {
                 int cn = getint(p), tp = getint(p), td = getint(p);
@@ -2129,13 +2221,15 @@ namespace game
             case N_DEMOPLAYBACK:
             {
                 int on = getint(p);
+                // the server restarts playback from a keyframe when seeking, which replaces everyone
+                bool seek = on && demoplayback;
                 if(on) self->state = CS_SPECTATOR;
-                else clearclients();
+                if(!on || seek) clearclients(!seek);
                 demoplayback = on!=0;
                 self->clientnum = getint(p);
                 gamepaused = false;
                 checkfollow();
-                execident(on ? "demostart" : "demoend");
+                if(!seek) execident(on ? "demostart" : "demoend");
                 break;
             }
 
@@ -2386,31 +2480,40 @@ namespace game
             case N_DEMOPACKET: return;
             case N_SENDDEMO:
             {
-                string fname;
-                fname[0] = '\0';
-                int tag = getint(p);
-                loopv(demoreqs) if(demoreqs[i].tag == tag)
-            {
-                    copystring(fname, demoreqs[i].name);
-                    demoreqs.remove(i);
-                    break;
-                }
-                if(!fname[0])
+                int tag = getint(p), offset = getint(p), total = getint(p);
+                if(!offset)
                 {
-                    time_t t = time(NULL);
-                    size_t len = strftime(fname, sizeof(fname), "%Y-%m-%d_%H.%M.%S", localtime(&t));
-                    fname[min(len, sizeof(fname)-1)] = '\0';
+                    cleardemorecv();
+                    string fname;
+                    fname[0] = '\0';
+                    loopv(demoreqs) if(demoreqs[i].tag == tag)
+                    {
+                        copystring(fname, demoreqs[i].name);
+                        demoreqs.remove(i);
+                        break;
+                    }
+                    if(!fname[0])
+                    {
+                        time_t t = time(NULL);
+                        size_t len = strftime(fname, sizeof(fname), "%Y-%m-%d_%H.%M.%S", localtime(&t));
+                        fname[min(len, sizeof(fname)-1)] = '\0';
+                    }
+                    int len = strlen(fname);
+                    if(len < 4 || strcasecmp(&fname[len-4], ".dmo")) concatstring(fname, ".dmo");
+                    if(const char *buf = server::getdemofile(fname, true)) demorecv = openrawfile(buf, "wb");
+                    if(!demorecv) demorecv = openrawfile(fname, "wb");
+                    if(!demorecv) return;
+                    demorecvtag = tag;
+                    copystring(demorecvname, fname);
                 }
-                int len = strlen(fname);
-                if(len < 4 || strcasecmp(&fname[len-4], ".dmo")) concatstring(fname, ".dmo");
-                stream *demo = NULL;
-                if(const char *buf = server::getdemofile(fname, true)) demo = openrawfile(buf, "wb");
-                if(!demo) demo = openrawfile(fname, "wb");
-                if(!demo) return;
-                conoutf("received demo \"%s\"", fname);
+                else if(!demorecv || tag != demorecvtag) return;
                 ucharbuf b = p.subbuf(p.remaining());
-                demo->write(b.buf, b.maxlen);
-                delete demo;
+                if(demorecv->write(b.buf, b.maxlen) != size_t(b.maxlen)) { cleardemorecv(); return; }
+                if(offset + b.maxlen >= total)
+                {
+                    cleardemorecv();
+                    conoutf("received demo \"%s\"", demorecvname);
+                }
                 break;
             }
 
@@ -98,8 +98,8 @@ static struct mutatorinfo
     { "tactics", "Tactics",       MUT_TACTICS,      MUT_CLASSIC|MUT_INSTAGIB|MUT_EFFIC|MUT_RANDOMWEAPON,            "\f6Tactics\ff: you spawn with two random weapons and an extra 50 to your max health"       },
     { "voosh", "Voosh",           MUT_RANDOMWEAPON, MUT_CLASSIC|MUT_INSTAGIB|MUT_EFFIC|MUT_TACTICS,                 "\f6Voosh\ff: all players switch to a random weapon every 20 seconds"                       },
     { "vamp", "Vampire",          MUT_VAMPIRE,      MUT_INSTAGIB,                                                   "\f6Vampire\ff: your health slowly decreases, deal damage to regenerate it"                 },
-    { "mayhem", "Mayhem",         MUT_MAYHEM,       NULL,                                                           "\f6Mayhem\ff: headshots landed with hitscan weapons instantly kill opponents"              },
-    { "no-power", "No Power-ups", MUT_NOPOWERUP,    NULL,                                                           "\f6No Power-ups\ff: power-ups do not spawn"                                                },
+    { "mayhem", "Mayhem",         MUT_MAYHEM,       0,                                                              "\f6Mayhem\ff: headshots landed with hitscan weapons instantly kill opponents"              },
+    { "no-power", "No Power-ups", MUT_NOPOWERUP,    0,                                                              "\f6No Power-ups\ff: power-ups do not spawn"                                                },
     { "no-items", "No Items",     MUT_NOITEMS,      MUT_CLASSIC,                                                    "\f6No items\ff: items do not spawn"                                                        }
 };
 
@@ -1,4 +1,5 @@
 #include "game.h"
+#include "thread.h"
 #include "geoip.h"
 
 namespace game
@@ -42,6 +43,13 @@ namespace server
 
     struct clientinfo;
 
+    // per-client slots on the server-wide timer heap
+    enum { TIMER_EVENTS = 0, TIMER_INACTIVITY, TIMER_REGENERATION, TIMER_ENVIRONMENT, NUMTIMERS };
+
+    void scheduleevents(clientinfo *ci);
+    void scheduleeffect(clientinfo *ci, int kind);
+    void canceltimers(clientinfo *ci);
+
     struct gameevent
     {
         virtual ~gameevent() {}
@@ -49,7 +57,13 @@ namespace server
         virtual bool flush(clientinfo *ci, int fmillis);
         virtual void process(clientinfo *ci) {}
 
+        // game time at which flush() will consume the event, untimed events go at once
+        virtual int duemillis(int fmillis) const { return fmillis; }
+
         virtual bool keepable() const { return false; }
+
+        // returns the event to its pool instead of freeing it
+        virtual void release() { delete this; }
     };
 
     struct timedevent : gameevent
@@ -57,6 +71,7 @@ namespace server
         int millis;
 
         bool flush(clientinfo *ci, int fmillis);
+        int duemillis(int fmillis) const { return millis; }
     };
 
     struct hitinfo
@@ -73,6 +88,7 @@ namespace server
         vector<hitinfo> hits;
 
         void process(clientinfo *ci);
+        void release();
     };
 
     struct explodeevent : timedevent
@@ -83,11 +99,13 @@ namespace server
         bool keepable() const { return true; }
 
         void process(clientinfo *ci);
+        void release();
     };
 
     struct suicideevent : gameevent
     {
         void process(clientinfo *ci);
+        void release();
     };
 
     struct pickupevent : gameevent
@@ -95,8 +113,105 @@ namespace server
         int ent;
 
         void process(clientinfo *ci);
+        void release();
+    };
+
+    struct eventpoolstats
+    {
+        int allocs, reuses, hitgrowths, tickallocs, lastallocs, peakallocs;
+
+        eventpoolstats() : allocs(0), reuses(0), hitgrowths(0), tickallocs(0), lastallocs(0), peakallocs(0) {}
+
+        void tick()
+        {
+            lastallocs = tickallocs;
+            peakallocs = max(peakallocs, tickallocs);
+            tickallocs = 0;
+        }
+    } eventstats;
+
+    #define MAXPOOLEDEVENTS 1024
+
+    // recycles events of one type so that steady-state combat does not touch the heap
+    template<class T>
+    struct eventpool
+    {
+        vector<T *> pooled;
+
+        ~eventpool() { pooled.deletecontents(); }
+
+        T *alloc()
+        {
+            if(pooled.length())
+            {
+                eventstats.reuses++;
+                return pooled.pop();
+            }
+            eventstats.allocs++;
+            eventstats.tickallocs++;
+            return new T;
+        }
+
+        void release(T *e)
+        {
+            if(pooled.length() < MAXPOOLEDEVENTS) pooled.add(e);
+            else delete e;
+        }
     };
 
+    eventpool<shotevent> shotevents;
+    eventpool<explodeevent> explodeevents;
+    eventpool<suicideevent> suicideevents;
+    eventpool<pickupevent> pickupevents;
+
+    void shotevent::release() { hits.setsize(0); shotevents.release(this); }
+    void explodeevent::release() { hits.setsize(0); explodeevents.release(this); }
+    void suicideevent::release() { suicideevents.release(this); }
+    void pickupevent::release() { pickupevents.release(this); }
+
+    // pending events of one client, consumed strictly from the front
+    struct eventqueue
+    {
+        vector<gameevent *> buf;
+        int head;
+
+        eventqueue() : head(0) {}
+
+        bool empty() const { return head >= buf.length(); }
+        int length() const { return buf.length() - head; }
+        gameevent *&operator[](int i) { return buf[head + i]; }
+
+        void add(gameevent *e) { buf.add(e); }
+
+        gameevent *popfront()
+        {
+            gameevent *e = buf[head++];
+            if(head >= buf.length()) { buf.setsize(0); head = 0; }
+            else if(head >= 64 && 2*head >= buf.length()) { buf.remove(0, head); head = 0; }
+            return e;
+        }
+
+        void setsize(int n)
+        {
+            if(n > 0) buf.setsize(head + n);
+            else { buf.setsize(0); head = 0; }
+        }
+    };
+
+    static inline void clearevents(eventqueue &events)
+    {
+        for(int i = events.head; i < events.buf.length(); i++) events.buf[i]->release();
+        events.setsize(0);
+    }
+
+    ICOMMAND(eventpoolstats, "", (),
+    {
+        conoutf("events: %d allocated, %d reused, %d pooled, %d hit array growths, %d allocations last tick, %d peak",
+            eventstats.allocs, eventstats.reuses,
+            shotevents.pooled.length() + explodeevents.pooled.length() + suicideevents.pooled.length() + pickupevents.pooled.length(),
+            eventstats.hitgrowths, eventstats.lastallocs, eventstats.peakallocs);
+    });
+
     template <int N>
     struct projectilestate
     {
@@ -224,6 +339,13 @@ namespace server
 
     extern int gamemillis, nextexceeded;
 
+    // the last state of a client that a receiver acknowledged, which its next deltas are encoded against
+    struct posbaseline
+    {
+        int seq;
+        posstate state;
+    };
+
     struct clientinfo
     {
         int clientnum, ownernum, connectmillis, sessionid, overflow;
@@ -234,16 +356,30 @@ namespace server
         bool connected, local, timesync, ghost, mute;
         int gameoffset, lastevent, pushed, exceeded;
         servstate state;
-        vector<gameevent *> events;
+        eventqueue events;
+        int timerdue[NUMTIMERS];
+        bool powerupticking;
         vector<uchar> position, messages;
         uchar *wsdata;
         int wslen;
+        int lastfarpos, relevantstart, numrelevant;
+        clientinfo *relevantgroup;
+        bool posdelta;
+        int posseq, posack;
+        posstate pos;
+        posframe posframes[POSFRAMES];
+        vector<posbaseline> posbases;
+        vector<uchar> posdeltabuf;
+        int posdeltabase, posdeltanum;
+        bool posdeltaready;
         vector<clientinfo *> bots;
         int ping, aireinit;
         string clientmap;
         int mapcrc;
         bool warned, damagemat;
         ENetPacket *getdemo, *getmap, *clipboard;
+        stream *demosend;
+        int demosendtag, demosendpos, demosendlen;
         int lastclipboard, needclipboard;
         int connectauth;
         uint authreq;
@@ -257,13 +393,17 @@ namespace server
         char customflag_code[MAXCOUNTRYCODELEN+1];
         string customflag_name;
 
-        clientinfo() : getdemo(NULL), getmap(NULL), clipboard(NULL), authchallenge(NULL), authkickreason(NULL) { reset(); mute = false; }
-        ~clientinfo() { events.deletecontents(); cleanclipboard(); cleanauth(); }
+        clientinfo() : powerupticking(false), getdemo(NULL), getmap(NULL), clipboard(NULL), demosend(NULL), authchallenge(NULL), authkickreason(NULL) { loopi(NUMTIMERS) timerdue[i] = -1; reset(); mute = false; }
+        ~clientinfo() { canceltimers(this); clearevents(events); cleanclipboard(); cleanauth(); DELETEP(demosend); }
 
         void addevent(gameevent *e)
         {
-            if(state.state==CS_SPECTATOR || events.length()>100) delete e;
-            else events.add(e);
+            if(state.state==CS_SPECTATOR || events.length()>100) e->release();
+            else
+            {
+                events.add(e);
+                if(events.length() == 1) scheduleevents(this);
+            }
         }
 
         enum
@@ -312,7 +452,7 @@ namespace server
             modevote = INT_MAX;
             mutsvote = 0;
             state.reset();
-            events.deletecontents();
+            clearevents(events);
             overflow = 0;
             timesync = false;
             lastevent = 0;
@@ -327,7 +467,7 @@ namespace server
         void reassign()
         {
             state.reassign();
-            events.deletecontents();
+            clearevents(events);
             timesync = false;
             lastevent = 0;
         }
@@ -351,6 +491,30 @@ namespace server
             if(full) cleanauthkick();
         }
 
+        void resetposdelta(bool enable)
+        {
+            posdelta = enable;
+            posack = -1;
+            loopi(POSFRAMES) { posframes[i].seq = -1; posframes[i].states.setsize(0); }
+            posbases.setsize(0);
+        }
+
+        // the states in an acknowledged frame become the baselines of the clients they belong to
+        void ackposframe(int ack)
+        {
+            posack = ack;
+            const posframe &frame = posframes[ack%POSFRAMES];
+            if(frame.seq != ack) return;
+            loopv(frame.states)
+            {
+                const posstate &ps = frame.states[i];
+                while(posbases.length() <= ps.cn) posbases.add().seq = -1;
+                posbaseline &base = posbases[ps.cn];
+                base.seq = ack;
+                base.state = ps;
+            }
+        }
+
         void reset()
         {
             name[0] = 0;
@@ -362,6 +526,10 @@ namespace server
             connectauth = 0;
             position.setsize(0);
             messages.setsize(0);
+            lastfarpos = 0;
+            relevantgroup = NULL;
+            posseq = 0;
+            resetposdelta(false);
             ping = 0;
             aireinit = 0;
             needclipboard = 0;
@@ -419,6 +587,10 @@ namespace server
     enet_uint32 lastsend = 0;
     int mastermode = MM_OPEN, mastermask = MM_PRIVSERV;
     stream *mapdata = NULL;
+    int welcomegen = 0;
+
+    // marks the map, item, master, pause, speed or team score state shared by all welcome packets as changed
+    static inline void changewelcome() { welcomegen++; }
 
     VAR(timelimit, 0, 10, 60);
     VAR(scorelimit, -1, -1, 1000);
@@ -479,6 +651,106 @@ namespace server
 
     vector<clientinfo *> connects, clients, bots;
 
+    // one pending wakeup of a client, keyed by the gamemillis it falls due at
+    struct servertimer
+    {
+        int due, cn, kind;
+        clientinfo *ci;
+
+        // ties go by client number and then slot, so timers due together fire in a fixed order
+        bool operator<(const servertimer &o) const
+        {
+            if(due != o.due) return due < o.due;
+            if(cn != o.cn) return cn < o.cn;
+            return kind < o.kind;
+        }
+    };
+
+    // binary min-heap on exact integer keys, which the float scored vector heap cannot give once gamemillis grows large
+    vector<servertimer> servertimers;
+
+    static void addtimer(const servertimer &t)
+    {
+        int i = servertimers.length();
+        servertimers.add(t);
+        while(i > 0)
+        {
+            int pi = (i - 1) >> 1;
+            if(!(servertimers[i] < servertimers[pi])) break;
+            swap(servertimers[i], servertimers[pi]);
+            i = pi;
+        }
+    }
+
+    static servertimer removetimer()
+    {
+        servertimer t = servertimers.removeunordered(0);
+        int n = servertimers.length(), i = 0;
+        for(;;)
+        {
+            int child = (i << 1) + 1, best = i;
+            if(child < n && servertimers[child] < servertimers[best]) best = child;
+            if(child+1 < n && servertimers[child+1] < servertimers[best]) best = child+1;
+            if(best == i) break;
+            swap(servertimers[i], servertimers[best]);
+            i = best;
+        }
+        return t;
+    }
+    vector<clientinfo *> powerupclients;
+
+    struct servertimerstats
+    {
+        int scheduled, fired, stale;
+
+        servertimerstats() : scheduled(0), fired(0), stale(0) {}
+    } timerstats;
+
+    // a client keeps at most one live entry per slot, entries superseded by an earlier one are skipped when popped
+    void scheduletimer(clientinfo *ci, int kind, int due)
+    {
+        int &cur = ci->timerdue[kind];
+        if(cur >= 0 && cur <= due) return;
+        cur = due;
+        servertimer t;
+        t.due = due;
+        t.cn = ci->clientnum;
+        t.kind = kind;
+        t.ci = ci;
+        addtimer(t);
+        timerstats.scheduled++;
+    }
+
+    void scheduleevents(clientinfo *ci)
+    {
+        if(!ci->events.empty()) scheduletimer(ci, TIMER_EVENTS, max(ci->events[0]->duemillis(gamemillis), 0));
+    }
+
+    void canceltimers(clientinfo *ci)
+    {
+        loopv(servertimers) if(servertimers[i].ci == ci) servertimers[i].ci = NULL;
+        powerupclients.removeobj(ci);
+    }
+
+    void resettimers()
+    {
+        servertimers.setsize(0);
+        loopv(clients) loopj(NUMTIMERS) clients[i]->timerdue[j] = -1;
+    }
+
+    void trackpowerup(clientinfo *ci)
+    {
+        if(ci->powerupticking || !ci->state.poweruptype || !ci->state.powerupmillis) return;
+        ci->powerupticking = true;
+        powerupclients.add(ci);
+    }
+
+    ICOMMAND(servertimerstats, "", (),
+    {
+        conoutf("timers: %d pending, %d scheduled, %d fired, %d superseded, %d powerups counting down",
+            servertimers.length(), timerstats.scheduled, timerstats.fired, timerstats.stale, powerupclients.length());
+    });
+
     void kickclients(uint ip, clientinfo *actor = NULL, int priv = PRIV_NONE)
     {
         loopvrev(clients)
@@ -660,21 +932,11 @@ namespace server
     COMMAND(maprotationreset, "");
     COMMANDN(maprotation, addmaprotations, "ss2V");
 
-    struct demofile
-    {
-        string info;
-        uchar *data;
-        int len;
-    };
-
-    vector<demofile> demos;
-
     bool demonextmatch = false;
-    stream *demotmp = NULL, *demorecord = NULL, *demoplayback = NULL;
+    struct demoreader;
+    demoreader *demoplayback = NULL;
     int nextplayback = 0, demomillis = 0;
 
-    VAR(maxdemos, 0, 5, 25);
-    VAR(maxdemosize, 0, 16, 31);
     VAR(restrictdemos, 0, 1, 1);
     VARF(autorecorddemo, 0, 0, 1, demonextmatch = autorecorddemo!=0);
 
@@ -839,6 +1101,7 @@ namespace server
         mcrc = 0;
         ments.setsize(0);
         sents.setsize(0);
+        changewelcome();
     }
 
     bool serveroption(const char *arg)
@@ -846,10 +1109,13 @@ namespace server
         return false;
     }
 
+    void loaddemostore();
+
     void serverinit()
     {
         smapname[0] = '\0';
         resetitems();
+        loaddemostore();
     }
 
     int numclients(int exclude = -1, bool excludespec = true, bool excludeai = true, bool priv = false)
@@ -922,6 +1188,8 @@ namespace server
     eliminationservmode eliminationmode;
     servmode *smode = NULL;
 
+    #include "lagcomp.h"
+
     bool canspawnitem(int type)
     {
         if (!validitem(type) || m_noitems(mutators))
@@ -1018,8 +1286,11 @@ namespace server
         }
         sents[i].spawned = false;
         sents[i].spawntime = spawntime(sents[i].type);
+        changewelcome();
         sendf(-1, 1, "ri3", N_ITEMACC, i, sender);
         ci->state.pickup(sents[i].type);
+        trackpowerup(ci);
+        scheduleeffect(ci, TIMER_REGENERATION);
         return true;
     }
 
@@ -1028,6 +1299,7 @@ namespace server
     void clearteaminfo()
     {
         loopi(MAXTEAMS) teaminfos[i].reset();
+        changewelcome();
     }
 
     clientinfo *choosebestclient(float &bestrank)
@@ -1118,90 +1390,28 @@ namespace server
         return 1+int(worst-teamranks);
     }
 
-    void prunedemos(int extra = 0)
-    {
-        int n = clamp(demos.length() + extra - maxdemos, 0, demos.length());
-        if(n <= 0) return;
-        loopi(n) delete[] demos[i].data;
-        demos.remove(0, n);
-    }
-
-    void adddemo()
-    {
-        if(!demotmp) return;
-        int len = (int)min(demotmp->size(), stream::offset((maxdemosize<<20) + 0x10000));
-        demofile &d = demos.add();
-        time_t t = time(NULL);
-        char *timestr = ctime(&t), *trim = timestr + strlen(timestr);
-        while(trim>timestr && iscubespace(*--trim)) *trim = '\0';
-        formatstring(d.info, "%s: %s, %s, %.2f%s", timestr, modeprettyname(gamemode), smapname, len > 1024*1024 ? len/(1024*1024.f) : len/1024.0f, len > 1024*1024 ? "MB" : "kB");
-        sendservmsgf("demo \"%s\" recorded", d.info);
-        d.data = new uchar[len];
-        d.len = len;
-        demotmp->seek(0, SEEK_SET);
-        demotmp->read(d.data, len);
-        DELETEP(demotmp);
-    }
-
-    void enddemorecord()
-    {
-        if(!demorecord) return;
-
-        DELETEP(demorecord);
-
-        if(!demotmp) return;
-        if(!maxdemos || !maxdemosize) { DELETEP(demotmp); return; }
-
-        prunedemos(1);
-        adddemo();
-    }
+    int welcomedemopacket(packetbuf& p);
 
-    void writedemo(int chan, void *data, int len)
-    {
-        if(!demorecord) return;
-        int stamp[3] = { gamemillis, chan, len };
-        lilswap(stamp, 3);
-        demorecord->write(stamp, sizeof(stamp));
-        demorecord->write(data, len);
-        if(demorecord->rawtell() >= (maxdemosize<<20)) enddemorecord();
-    }
+    #include "demostore.h"
 
     void recordpacket(int chan, void *data, int len)
     {
         writedemo(chan, data, len);
     }
 
-    int welcomedemopacket(packetbuf& p);
     void sendwelcome(clientinfo *ci);
 
     void setupdemorecord()
     {
         if(!m_mp(gamemode) || m_edit) return;
 
-        demotmp = opentempfile("demorecord", "w+b");
-        if(!demotmp) return;
-
-        stream *f = opengzfile(NULL, "wb", demotmp);
-        if (!f)
-        { 
-            DELETEP(demotmp);
-            return;
-        }
+        if(!opendemorecord()) return;
 
         sendservmsg("recording demo");
 
-        demorecord = f;
+        demorecord = true;
 
-        demoheader hdr;
-        memcpy(hdr.magic, DEMO_MAGIC, sizeof(hdr.magic));
-        hdr.version = DEMO_VERSION;
-        hdr.protocol = PROTOCOL_VERSION;
-        lilswap(&hdr.version, 2);
-        demorecord->write(&hdr, sizeof(demoheader));
-
-        packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
-        welcomedemopacket(p);
-        writedemo(1, p.buf, p.len);
+        startdemoblock();
     }
 
     void listdemos(int cn)
@@ -1217,13 +1427,13 @@ namespace server
     {
         if(!n)
         {
-            loopv(demos) delete[] demos[i].data;
+            loopv(demos) if(const char *file = demostorepath(demos[i].name, "dmo")) remove(file);
             demos.shrink(0);
             sendservmsg("cleared all demos");
         }
         else if(demos.inrange(n-1))
         {
-            delete[] demos[n-1].data;
+            if(const char *file = demostorepath(demos[n-1].name, "dmo")) remove(file);
             demos.remove(n-1);
             sendservmsgf("cleared demo %d", n);
         }
@@ -1247,14 +1457,39 @@ namespace server
         }
     }
 
+    // sends the next chunk of a demo download once the client has acknowledged the previous one
+    void senddemochunk(clientinfo *ci)
+    {
+        if(!ci->demosend || ci->getdemo) return;
+        int chunk = min(ci->demosendlen - ci->demosendpos, DEMOCHUNKSIZE);
+        packetbuf p(MAXTRANS + chunk, ENET_PACKET_FLAG_RELIABLE);
+        putint(p, N_SENDDEMO);
+        putint(p, ci->demosendtag);
+        putint(p, ci->demosendpos);
+        putint(p, ci->demosendlen);
+        if(ci->demosend->read(p.subbuf(chunk).buf, chunk) != size_t(chunk)) { DELETEP(ci->demosend); return; }
+        ci->demosendpos += chunk;
+        if(ci->demosendpos >= ci->demosendlen) DELETEP(ci->demosend);
+        ci->getdemo = p.finalize();
+        ci->getdemo->freeCallback = freegetdemo;
+        sendpacket(ci->clientnum, 2, ci->getdemo);
+    }
+
     void senddemo(clientinfo *ci, int num, int tag)
     {
-        if(ci->getdemo) return;
+        if(ci->getdemo || ci->demosend) return;
         if(!num) num = demos.length();
         if(!demos.inrange(num-1)) return;
         demofile &d = demos[num-1];
-        if((ci->getdemo = sendf(ci->clientnum, 2, "riim", N_SENDDEMO, tag, d.len, d.data)))
-            ci->getdemo->freeCallback = freegetdemo;
+        const char *file = demostorefile(d.name, "dmo");
+        stream *f = file ? openrawfile(file, "rb") : NULL;
+        if(!f) return;
+        d.lastused = totalmillis;
+        ci->demosend = f;
+        ci->demosendtag = tag;
+        ci->demosendpos = 0;
+        ci->demosendlen = (int)min(f->size(), stream::offset(d.len));
+        senddemochunk(ci);
     }
 
     void enddemoplayback()
@@ -1269,24 +1504,6 @@ namespace server
         loopv(clients) sendwelcome(clients[i]);
     }
 
-    SVARP(demodir, "demo");
-
-    const char *getdemofile(const char *file, bool init)
-    {
-        if(!demodir[0]) return NULL;
-        static string buf;
-        copystring(buf, demodir);
-        int dirlen = strlen(buf);
-        if(buf[dirlen] != '/' && buf[dirlen] != '\\' && dirlen+1 < (int)sizeof(buf)) { buf[dirlen++] = '/'; buf[dirlen] = '\0'; }
-        if(init)
-        {
-            const char *dir = findfile(buf, "w");
-            if(!fileexists(dir, "w")) createdir(dir);
-        }
-        concatstring(buf, file);
-        return buf;
-    }
-
     void setupdemoplayback()
     {
         if(demoplayback) return;
@@ -1297,15 +1514,15 @@ namespace server
         copystring(file, smapname);
         int len = strlen(file);
         if(len < 4 || strcasecmp(&file[len-4], ".dmo")) concatstring(file, ".dmo");
-        if(const char *buf = getdemofile(file, false)) demoplayback = opengzfile(buf, "rb");
-        if(!demoplayback) demoplayback = opengzfile(file, "rb");
-        if(!demoplayback) formatstring(msg, "could not read demo \"%s\"", file);
-        else if(demoplayback->read(&hdr, sizeof(demoheader))!=sizeof(demoheader) || memcmp(hdr.magic, DEMO_MAGIC, sizeof(hdr.magic)))
+        stream *f = NULL;
+        if(const char *buf = getdemofile(file, false)) f = openfile(buf, "rb");
+        if(!f) f = openfile(file, "rb");
+        if(!f) formatstring(msg, "could not read demo \"%s\"", file);
+        else if(!(demoplayback = new demoreader)->open(f, hdr))
             formatstring(msg, "\"%s\" is not a demo file", file);
         else
         {
-            lilswap(&hdr.version, 2);
-            if(hdr.version!=DEMO_VERSION) formatstring(msg, "demo \"%s\" requires an %s version of Tesseract", file, hdr.version<DEMO_VERSION ? "older" : "newer");
+            if(hdr.version<1 || hdr.version>DEMO_VERSION) formatstring(msg, "demo \"%s\" requires an %s version of Tesseract", file, hdr.version<DEMO_VERSION ? "older" : "newer");
             else if(hdr.protocol!=PROTOCOL_VERSION) formatstring(msg, "demo \"%s\" requires an %s version of Tesseract", file, hdr.protocol<PROTOCOL_VERSION ? "older" : "newer");
         }
         if(msg[0])
@@ -1341,17 +1558,31 @@ namespace server
             }
             lilswap(&chan, 1);
             lilswap(&len, 1);
-            ENetPacket *packet = enet_packet_create(NULL, len+1, 0);
-            if(!packet || demoplayback->read(packet->data+1, len)!=size_t(len))
+            // keyframes repeat the game state for seeking, so only the one playback starts from is sent
+            bool keyframe = demoplayback->keyframe;
+            demoplayback->keyframe = false;
+            if(chan==DEMO_KEYFRAME && !keyframe)
             {
-                if(packet) enet_packet_destroy(packet);
-                enddemoplayback();
-                return;
+                if(!demoplayback->skip(len))
+                {
+                    enddemoplayback();
+                    return;
+                }
+            }
+            else
+            {
+                ENetPacket *packet = enet_packet_create(NULL, len+1, 0);
+                if(!packet || demoplayback->read(packet->data+1, len)!=size_t(len))
+                {
+                    if(packet) enet_packet_destroy(packet);
+                    enddemoplayback();
+                    return;
+                }
+                packet->data[0] = N_DEMOPACKET;
+                sendpacket(-1, chan==DEMO_KEYFRAME ? 1 : chan, packet);
+                if(!packet->referenceCount) enet_packet_destroy(packet);
+                if(!demoplayback) break;
             }
-            packet->data[0] = N_DEMOPACKET;
-            sendpacket(-1, chan, packet);
-            if(!packet->referenceCount) enet_packet_destroy(packet);
-            if(!demoplayback) break;
             if(demoplayback->read(&nextplayback, sizeof(nextplayback))!=sizeof(nextplayback))
             {
                 enddemoplayback();
@@ -1368,6 +1599,23 @@ namespace server
         else gamelimit = max(gamelimit, nextplayback + secs*1000);
     }
 
+    // restarts playback from the keyframe of block n, resetting clients to the state it records
+    bool seekdemoblock(int n)
+    {
+        if(!demoplayback->loadblock(n) || demoplayback->read(&nextplayback, sizeof(nextplayback))!=sizeof(nextplayback))
+        {
+            enddemoplayback();
+            return false;
+        }
+        lilswap(&nextplayback, 1);
+        demoplayback->keyframe = true;
+        sendf(-1, 1, "ri3", N_DEMOPLAYBACK, 1, -1);
+        gamemillis = nextplayback;
+        if(gamemillis < gamelimit) interm = 0;
+        readdemo();
+        return demoplayback != NULL;
+    }
+
     void seekdemo(char *t)
     {
         if(!demoplayback) return;
@@ -1378,6 +1626,12 @@ namespace server
         else { secs = mins; mins = 0; }
         if(*t == '.') millis = strtoul(t+1, &t, 10);
         int offset = max(millis + (mins*60 + secs)*1000, 0), prevmillis = gamemillis;
+        if(demoplayback->seekable())
+        {
+            // jump to the nearest keyframe when going back, or when the target lies beyond the current block
+            int target = max(rev ? gamelimit - offset : offset, 0), block = demoplayback->findblock(target);
+            if((target < gamemillis || block > demoplayback->curblock) && !seekdemoblock(block)) return;
+        }
         if(rev) while(gamelimit - offset > gamemillis)
         {
             gamemillis = gamelimit - offset;
@@ -1388,7 +1642,7 @@ namespace server
             gamemillis = offset;
             readdemo();
         }
-        if(gamemillis > prevmillis)
+        if(gamemillis != prevmillis)
         {
             if(!interm) sendf(-1, 1, "ri3", N_TIMEUP, max((gamelimit - gamemillis)/1000, 1), TimeUpdate_Match);
 #ifndef STANDALONE
@@ -1419,6 +1673,7 @@ namespace server
     {
         if(gamepaused==val) return;
         gamepaused = val;
+        changewelcome();
         sendf(-1, 1, "riii", N_PAUSEGAME, gamepaused ? 1 : 0, ci ? ci->clientnum : -1);
     }
 
@@ -1442,6 +1697,7 @@ namespace server
         val = clamp(val, 10, 1000);
         if(gamespeed==val) return;
         gamespeed = val;
+        changewelcome();
         sendf(-1, 1, "riii", N_GAMESPEED, gamespeed, ci ? ci->clientnum : -1);
     }
 
@@ -1516,6 +1772,7 @@ namespace server
     void revokemaster(clientinfo *ci)
     {
         ci->privilege = PRIV_NONE;
+        changewelcome();
         if(ci->state.state==CS_SPECTATOR && !ci->local)
         {
             aimanager::removeai(ci);
@@ -1553,6 +1810,7 @@ namespace server
             }
             if(trial) return true;
             ci->privilege = wantpriv;
+            changewelcome();
             if(validprivilege(ci->privilege)) name = privilegenames[ci->privilege];
         }
         else
@@ -1568,6 +1826,7 @@ namespace server
         {
             mastermode = MM_OPEN;
             allowedips.shrink(0);
+            changewelcome();
         }
         string msg;
         if(val && authname)
@@ -1715,13 +1974,16 @@ namespace server
                 N_CDIS, N_CURRENTMASTER, N_PONG, N_RESUME,
                 N_ANNOUNCE, N_SENDDEMOLIST, N_SENDDEMO, N_DEMOPLAYBACK, N_SENDMAP,
                 N_DROPFLAG, N_SCOREFLAG, N_RETURNFLAG, N_RESETFLAG, N_ROUND, N_ROUNDSCORE, N_ASSIGNROLE, N_SCORE, N_VOOSH,
-                N_CLIENT, N_AUTHCHAL, N_INITAI, N_DEMOPACKET, -2, N_CALCLIGHT, N_REMIP, N_NEWMAP, N_GETMAP, N_SENDMAP,
+                N_CLIENT, N_AUTHCHAL, N_INITAI, N_DEMOPACKET, N_POSDELTA, -2, N_CALCLIGHT, N_REMIP, N_NEWMAP, N_GETMAP, N_SENDMAP,
                 N_CLIPBOARD, -3, N_EDITENT, N_EDITF, N_EDITT, N_EDITM, N_FLIP, N_COPY, N_PASTE, N_ROTATE, N_REPLACE, N_DELCUBE, N_EDITVAR, N_EDITVSLOT,
                 N_UNDO, N_REDO, -4, N_POS, NUMMSG),
       connectfilter(-1, N_CONNECT, -2, N_AUTHANS, -3, N_PING, NUMMSG);
 
+    uint msgcounts[NUMMSG];
+
     int checktype(int type, clientinfo *ci)
     {
+        if(type >= 0 && type < NUMMSG) msgcounts[type]++;
         if(ci)
         {
             if(!ci->connected) switch(connectfilter[type])
@@ -1752,34 +2014,73 @@ namespace server
         return type;
     }
 
+    // a reusable buffer that worldstate packets point into, returned to the pool once the last packet referencing it is freed
     struct worldstate
     {
-        int uses, len;
+        int uses, size;
         uchar *data;
 
-        worldstate() : uses(0), len(0), data(NULL) {}
+        worldstate() : uses(0), size(0), data(NULL) {}
+        ~worldstate() { DELETEA(data); }
 
-        void setup(int n) { len = n; data = new uchar[n]; }
-        void cleanup() { DELETEA(data); len = 0; }
-        bool contains(const uchar *p) const { return p >= data && p < &data[len]; }
+        bool reserve(int n)
+        {
+            if(n <= size) return false;
+            DELETEA(data);
+            size = n;
+            data = new uchar[size];
+            return true;
+        }
     };
-    vector<worldstate> worldstates;
+
+    #define MAXPOOLEDWORLDSTATES 256
+
+    struct worldstatepool
+    {
+        vector<worldstate *> pooled;
+        int slabs, live, peaklive, allocs, growths, highwater;
+
+        worldstatepool() : slabs(0), live(0), peaklive(0), allocs(0), growths(0), highwater(0) {}
+        ~worldstatepool() { pooled.deletecontents(); }
+
+        worldstate *get(int n)
+        {
+            worldstate *ws;
+            if(pooled.length()) ws = pooled.pop();
+            else { ws = new worldstate; slabs++; allocs++; }
+            // slabs grow straight to the largest tick seen, rounded up so that they settle at one size
+            while(highwater < n) highwater = max(highwater*2, 1024);
+            if(ws->reserve(highwater)) growths++;
+            peaklive = max(peaklive, ++live);
+            return ws;
+        }
+
+        void put(worldstate *ws)
+        {
+            ws->uses = 0;
+            live--;
+            if(pooled.length() < MAXPOOLEDWORLDSTATES) pooled.add(ws);
+            else { delete ws; slabs--; }
+        }
+    } worldstates;
     bool reliablemessages = false;
 
     void cleanworldstate(ENetPacket *packet)
     {
-        loopv(worldstates)
+        worldstate *ws = (worldstate *)packet->userData;
+        if(ws && --ws->uses <= 0) worldstates.put(ws);
+    }
+
+    // makes a packet sent out of ws hold the slab until ENet frees it
+    static inline void holdworldstate(worldstate &ws, ENetPacket *packet)
+    {
+        if(packet->referenceCount)
         {
-            worldstate &ws = worldstates[i];
-            if(!ws.contains(packet->data)) continue;
-            ws.uses--;
-            if(ws.uses <= 0)
-            {
-                ws.cleanup();
-                worldstates.removeunordered(i);
-            }
-            break;
+            ws.uses++;
+            packet->userData = &ws;
+            packet->freeCallback = cleanworldstate;
         }
+        else enet_packet_destroy(packet);
     }
 
     void flushclientposition(clientinfo &ci)
@@ -1791,6 +2092,79 @@ namespace server
         sendpacket(-1, 0, p.finalize(), ci.ownernum);
     }
 
+    VAR(posrelevance, 0, 0, 1);
+    VAR(posrelevancedist, 0, 1024, 1<<16);
+    VAR(farposrate, 0, 200, 1000);
+    VARF(allowposdelta, 0, 1, 1, { if(!allowposdelta) loopv(clients) clients[i]->resetposdelta(false); });
+
+    struct posupdate
+    {
+        clientinfo *ci, *owner;
+        uchar *data;
+        int len;
+        bool due;
+    };
+    vector<posupdate> posupdates;
+    vector<ushort> relevantpos;
+
+    static inline void queueposition(clientinfo &bi, clientinfo &ci)
+    {
+        if(bi.position.empty()) return;
+        posupdate &u = posupdates.add();
+        u.ci = &bi;
+        u.owner = &ci;
+        u.data = NULL;
+        u.len = 0;
+        u.due = !posrelevance || m_edit || totalmillis - bi.lastfarpos >= farposrate;
+        if(u.due) bi.lastfarpos = totalmillis;
+    }
+
+    static inline bool isrelevant(clientinfo &ci, const posupdate &u)
+    {
+        // spectators and dead players may follow anyone, so only living players get culled updates
+        if(u.due || ci.state.state != CS_ALIVE) return true;
+        clientinfo &pi = *u.ci;
+        if(m_teammode && sameteam(ci.team, pi.team)) return true;
+        return ci.state.o.squaredist(pi.state.o) <= float(posrelevancedist)*posrelevancedist;
+    }
+
+    static void calcrelevance()
+    {
+        relevantpos.setsize(0);
+        loopv(clients)
+        {
+            clientinfo &ci = *clients[i];
+            ci.relevantstart = ci.numrelevant = 0;
+            ci.relevantgroup = NULL;
+            if(ci.state.aitype != AI_NONE || !posrelevance || ci.posdelta) continue;
+            int start = relevantpos.length();
+            bool culled = false;
+            loopvj(posupdates)
+            {
+                posupdate &u = posupdates[j];
+                if(u.owner == &ci) continue;
+                if(isrelevant(ci, u)) relevantpos.add(j);
+                else culled = true;
+            }
+            if(!culled) { relevantpos.setsize(start); continue; }
+            ci.relevantgroup = &ci;
+            ci.relevantstart = start;
+            ci.numrelevant = relevantpos.length() - start;
+            // receivers with identical sets share the same packets
+            loopvj(clients)
+            {
+                if(j >= i) break;
+                clientinfo &oi = *clients[j];
+                if(oi.relevantgroup != &oi || oi.numrelevant != ci.numrelevant ||
+                   memcmp(&relevantpos[oi.relevantstart], &relevantpos[start], ci.numrelevant*sizeof(ushort))) continue;
+                ci.relevantgroup = &oi;
+                relevantpos.setsize(start);
+                ci.relevantstart = oi.relevantstart;
+                break;
+            }
+        }
+    }
+
     static void sendpositions(worldstate &ws, ucharbuf &wsbuf)
     {
         if(wsbuf.empty()) return;
@@ -1800,31 +2174,296 @@ namespace server
         loopv(clients)
         {
             clientinfo &ci = *clients[i];
-            if(ci.state.aitype != AI_NONE) continue;
+            if(ci.state.aitype != AI_NONE || ci.relevantgroup || ci.posdelta) continue;
             uchar *data = wsbuf.buf;
             int size = wslen;
             if(ci.wsdata >= wsbuf.buf) { data = ci.wsdata + ci.wslen; size -= ci.wslen; }
             if(size <= 0) continue;
             ENetPacket *packet = enet_packet_create(data, size, ENET_PACKET_FLAG_NO_ALLOCATE);
             sendpacket(ci.clientnum, 0, packet);
-            if(packet->referenceCount) { ws.uses++; packet->freeCallback = cleanworldstate; }
-            else enet_packet_destroy(packet);
+            holdworldstate(ws, packet);
         }
         wsbuf.offset(wsbuf.length());
     }
 
-    static inline void addposition(worldstate &ws, ucharbuf &wsbuf, int mtu, clientinfo &bi, clientinfo &ci)
+    static inline void addposition(worldstate &ws, ucharbuf &wsbuf, int mtu, posupdate &u)
     {
-        if(bi.position.empty()) return;
+        clientinfo &bi = *u.ci, &ci = *u.owner;
         if(wsbuf.length() + bi.position.length() > mtu) sendpositions(ws, wsbuf);
         int offset = wsbuf.length();
         wsbuf.put(bi.position.getbuf(), bi.position.length());
         bi.position.setsize(0);
         int len = wsbuf.length() - offset;
+        u.data = &wsbuf.buf[offset];
+        u.len = len;
         if(ci.wsdata < wsbuf.buf) { ci.wsdata = &wsbuf.buf[offset]; ci.wslen = len; }
         else ci.wslen += len;
     }
 
+    static void flushrelevantpositions(worldstate &ws, ucharbuf &wsbuf, clientinfo &gi)
+    {
+        if(wsbuf.empty()) return;
+        ENetPacket *packet = enet_packet_create(wsbuf.buf, wsbuf.length(), ENET_PACKET_FLAG_NO_ALLOCATE);
+        loopv(clients) if(clients[i]->relevantgroup == &gi) sendpacket(clients[i]->clientnum, 0, packet);
+        holdworldstate(ws, packet);
+        wsbuf.offset(wsbuf.length());
+    }
+
+    static void addrelevantpositions(worldstate &ws, ucharbuf &wsbuf, int mtu, clientinfo &gi)
+    {
+        loopi(gi.numrelevant)
+        {
+            posupdate &u = posupdates[relevantpos[gi.relevantstart + i]];
+            if(wsbuf.length() + u.len > mtu) flushrelevantpositions(ws, wsbuf, gi);
+            wsbuf.put(u.data, u.len);
+        }
+        flushrelevantpositions(ws, wsbuf, gi);
+    }
+
+    static bool sendrelevantpositions(int mtu)
+    {
+        int wsmax = 0;
+        loopv(clients)
+        {
+            clientinfo &ci = *clients[i];
+            if(ci.relevantgroup == &ci) loopj(ci.numrelevant) wsmax += posupdates[relevantpos[ci.relevantstart + j]].len;
+        }
+        if(wsmax <= 0) return false;
+        worldstate &ws = *worldstates.get(wsmax);
+        ucharbuf wsbuf(ws.data, wsmax);
+        loopv(clients)
+        {
+            clientinfo &ci = *clients[i];
+            if(ci.relevantgroup == &ci) addrelevantpositions(ws, wsbuf, mtu, ci);
+        }
+        if(ws.uses) return true;
+        worldstates.put(&ws);
+        return false;
+    }
+
+    vector<ushort> posorder;
+
+    static inline bool posordercmp(ushort a, ushort b) { return posupdates[a].ci->clientnum < posupdates[b].ci->clientnum; }
+
+    // only reads the shared position updates and only writes to ci, so receivers can be encoded in parallel
+    static void encodeposdelta(clientinfo &ci)
+    {
+        ci.posdeltaready = false;
+        int seq = ci.posseq + 1;
+        bool acked = ci.posack >= 0 && seq - ci.posack < POSFRAMES;
+        posframe &frame = ci.posframes[seq%POSFRAMES];
+        frame.seq = -1;
+        frame.states.setsize(0);
+        ci.posdeltabuf.setsize(0);
+        bitbuf<vector<uchar> > b(ci.posdeltabuf);
+        posstate zero;
+        zero.reset();
+        loopv(posorder)
+        {
+            posupdate &u = posupdates[posorder[i]];
+            if(u.owner == &ci || (posrelevance && !isrelevant(ci, u))) continue;
+            const posstate &ps = u.ci->pos;
+            // a client missing from the acknowledged frame is still encoded against the last state of it that was acknowledged
+            const posbaseline *base = acked && ci.posbases.inrange(ps.cn) ? &ci.posbases[ps.cn] : NULL;
+            if(base && (base->seq < 0 || seq - base->seq >= POSFRAMES)) base = NULL;
+            posstate::putdeltacn(b, ps.cn);
+            if(acked) posstate::putdeltabase(b, base ? ci.posack - base->seq : -1);
+            ps.putdelta(b, base ? base->state : zero);
+            frame.states.add(ps);
+        }
+        if(frame.states.empty()) return;
+        b.flush();
+        frame.seq = ci.posseq = seq;
+        ci.posdeltabase = acked ? ci.posack : -1;
+        ci.posdeltanum = frame.states.length();
+        ci.posdeltaready = true;
+    }
+
+    static void sendposdelta(clientinfo &ci)
+    {
+        packetbuf p(ci.posdeltabuf.length() + 16, 0);
+        putint(p, N_POSDELTA);
+        putint(p, ci.posseq);
+        putint(p, ci.posdeltabase);
+        putuint(p, ci.posdeltanum);
+        putuint(p, ci.posdeltabuf.length());
+        p.put(ci.posdeltabuf.getbuf(), ci.posdeltabuf.length());
+        sendpacket(ci.clientnum, 0, p.finalize());
+    }
+
+    #define MAXPOSDELTATHREADS 8
+
+    VAR(posdeltathreads, 0, 0, MAXPOSDELTATHREADS);
+
+    // encodes the position deltas of many receivers at once, with the main thread taking a share of the work;
+    // packets are still created and queued on the main thread, in client order
+    struct posdeltaworkers
+    {
+        threadhandle threads[MAXPOSDELTATHREADS];
+        int numthreads, next, quit;
+        semaphore wakeup, finished;
+        vector<clientinfo *> receivers;
+
+        posdeltaworkers() : numthreads(0), next(0), quit(0) {}
+        ~posdeltaworkers() { stop(); }
+
+        void encode()
+        {
+            for(int i = atomicadd(next, 1) - 1; i < receivers.length(); i = atomicadd(next, 1) - 1) encodeposdelta(*receivers[i]);
+        }
+
+        static int work(void *data)
+        {
+            posdeltaworkers &w = *(posdeltaworkers *)data;
+            for(;;)
+            {
+                w.wakeup.wait();
+                if(atomicload(w.quit)) break;
+                w.encode();
+                w.finished.post();
+            }
+            return 0;
+        }
+
+        // started on first use rather than while the config loads, as threads would not survive the fork of an arena
+        void update()
+        {
+            if(numthreads == posdeltathreads) return;
+            stop();
+            start(posdeltathreads);
+        }
+
+        void run(bool parallel = true)
+        {
+            if(parallel) update();
+            if(!parallel || !numthreads || receivers.length() < 2)
+            {
+                loopv(receivers) encodeposdelta(*receivers[i]);
+                return;
+            }
+            atomicstore(next, 0);
+            loopi(numthreads) wakeup.post();
+            encode();
+            loopi(numthreads) finished.wait();
+        }
+
+        void start(int n)
+        {
+            atomicstore(quit, 0);
+            for(numthreads = 0; numthreads < n; numthreads++) if(!threads[numthreads].start(work, this)) break;
+        }
+
+        void stop()
+        {
+            if(!numthreads) return;
+            atomicstore(quit, 1);
+            loopi(numthreads) wakeup.post();
+            loopi(numthreads) threads[i].join();
+            numthreads = 0;
+        }
+    } posdeltapool;
+
+    static bool sendposdeltas()
+    {
+        posorder.setsize(0);
+        loopv(posupdates) posorder.add(i);
+        posorder.sort(posordercmp);
+        vector<clientinfo *> &receivers = posdeltapool.receivers;
+        receivers.setsize(0);
+        loopv(clients)
+        {
+            clientinfo &ci = *clients[i];
+            if(ci.state.aitype == AI_NONE && ci.posdelta) receivers.add(&ci);
+        }
+        posdeltapool.run();
+        bool flush = false;
+        loopv(receivers) if(receivers[i]->posdeltaready)
+        {
+            sendposdelta(*receivers[i]);
+            flush = true;
+        }
+        return flush;
+    }
+
+    // encodes ticks of position deltas for peers moving receivers that acknowledge two ticks late,
+    // once serially and once on the worker threads, checking that both produce the same bytes
+    static void posdeltabench(int peers, int ticks)
+    {
+        peers = clamp(peers, 2, 128);
+        ticks = clamp(ticks, 1, 100000);
+        vector<clientinfo *> bench;
+        loopi(peers)
+        {
+            clientinfo *ci = new clientinfo;
+            ci->clientnum = ci->ownernum = i;
+            ci->team = 1 + i%2;
+            ci->state.state = CS_ALIVE;
+            ci->resetposdelta(true);
+            ci->pos.reset(i);
+            bench.add(ci);
+        }
+        vector<clientinfo *> &receivers = posdeltapool.receivers;
+        vector<uchar> serial;
+        vector<int> serialends;
+        ullong serialnanos = 0, parallelnanos = 0;
+        int mismatches = 0;
+        ullong bytes = 0;
+        loopi(ticks)
+        {
+            posupdates.setsize(0);
+            posorder.setsize(0);
+            loopvj(bench)
+            {
+                clientinfo &ci = *bench[j];
+                loopk(NUMPOSFIELDS) if(rnd(3)) ci.pos.vals[k] += rnd(64) - 32;
+                ci.state.o = vec(ci.pos.vals[POS_X], ci.pos.vals[POS_Y], ci.pos.vals[POS_Z]).div(DMF);
+                if(ci.posseq - 2 > ci.posack) ci.ackposframe(ci.posseq - 2);
+                posupdate &u = posupdates.add();
+                u.ci = u.owner = &ci;
+                u.data = NULL;
+                u.len = 0;
+                u.due = rnd(4) == 0;
+                posorder.add(j);
+            }
+            receivers.setsize(0);
+            receivers.put(bench.getbuf(), bench.length());
+
+            ullong start = getservernanos();
+            posdeltapool.run(false);
+            serialnanos += getservernanos() - start;
+            serial.setsize(0);
+            serialends.setsize(0);
+            loopvj(bench)
+            {
+                clientinfo &ci = *bench[j];
+                if(ci.posdeltaready) { serial.put(ci.posdeltabuf.getbuf(), ci.posdeltabuf.length()); ci.posseq--; }
+                serialends.add(serial.length());
+            }
+
+            start = getservernanos();
+            posdeltapool.run();
+            parallelnanos += getservernanos() - start;
+            loopvj(bench)
+            {
+                clientinfo &ci = *bench[j];
+                int from = j ? serialends[j-1] : 0, len = ci.posdeltaready ? ci.posdeltabuf.length() : 0;
+                if(len != serialends[j] - from || (len && memcmp(ci.posdeltabuf.getbuf(), &serial[from], len))) mismatches++;
+                bytes += len;
+            }
+        }
+        posupdates.setsize(0);
+        posorder.setsize(0);
+        receivers.setsize(0);
+        bench.deletecontents();
+        int numthreads = posdeltapool.numthreads;
+        // the bench may run from the config, before arenas are forked, so leave no workers behind
+        posdeltapool.stop();
+        conoutf("posdeltabench: %d ticks to %d receivers, %.1f bytes per receiver per tick", ticks, peers, double(bytes)/ticks/peers);
+        conoutf("posdeltabench: serial %.3f us per tick, %d threads %.3f us per tick, %d mismatches",
+            serialnanos/1e3/ticks, numthreads, parallelnanos/1e3/ticks, mismatches);
+    }
+    ICOMMAND(posdeltabench, "ii", (int *peers, int *ticks), posdeltabench(*peers ? *peers : 64, *ticks ? *ticks : 10000));
+
     static void sendmessages(worldstate &ws, ucharbuf &wsbuf)
     {
         if(wsbuf.empty()) return;
@@ -1841,8 +2480,7 @@ namespace server
             if(size <= 0) continue;
             ENetPacket *packet = enet_packet_create(data, size, (reliablemessages ? ENET_PACKET_FLAG_RELIABLE : 0) | ENET_PACKET_FLAG_NO_ALLOCATE);
             sendpacket(ci.clientnum, 1, packet);
-            if(packet->referenceCount) { ws.uses++; packet->freeCallback = cleanworldstate; }
-            else enet_packet_destroy(packet);
+            holdworldstate(ws, packet);
         }
         wsbuf.offset(wsbuf.length());
     }
@@ -1878,18 +2516,20 @@ namespace server
             reliablemessages = false;
             return false;
         }
-        worldstate &ws = worldstates.add();
-        ws.setup(2*wsmax);
-        int mtu = getservermtu() - 100;
-        if(mtu <= 0) mtu = ws.len;
-        ucharbuf wsbuf(ws.data, ws.len);
+        posupdates.setsize(0);
         loopv(clients)
         {
             clientinfo &ci = *clients[i];
             if(ci.state.aitype != AI_NONE) continue;
-            addposition(ws, wsbuf, mtu, ci, ci);
-            loopvj(ci.bots) addposition(ws, wsbuf, mtu, *ci.bots[j], ci);
+            queueposition(ci, ci);
+            loopvj(ci.bots) queueposition(*ci.bots[j], ci);
         }
+        calcrelevance();
+        worldstate &ws = *worldstates.get(2*wsmax);
+        int mtu = getservermtu() - 100;
+        if(mtu <= 0) mtu = 2*wsmax;
+        ucharbuf wsbuf(ws.data, 2*wsmax);
+        loopv(posupdates) addposition(ws, wsbuf, mtu, posupdates[i]);
         sendpositions(ws, wsbuf);
         loopv(clients)
         {
@@ -1900,10 +2540,12 @@ namespace server
         }
         sendmessages(ws, wsbuf);
         reliablemessages = false;
+        // culled updates are copied out of the shared buffer, so it must outlive this
+        bool flush = sendrelevantpositions(mtu);
+        if(posupdates.length() && sendposdeltas()) flush = true;
         if(ws.uses) return true;
-        ws.cleanup();
-        worldstates.drop();
-        return false;
+        worldstates.put(&ws);
+        return flush;
     }
 
     bool sendpackets(bool force)
@@ -1911,11 +2553,73 @@ namespace server
         if(clients.empty() || (!hasnonlocalclients() && !demorecord)) return false;
         enet_uint32 curtime = enet_time_get()-lastsend;
         if(curtime<40 && !force) return false;
-        bool flush = buildworldstate();
+        bool flush;
+        {
+            tickscope scope(TICK_WORLDSTATE);
+            flush = buildworldstate();
+        }
         lastsend += curtime - (curtime%40);
         return flush;
     }
 
+    ICOMMAND(worldstatestats, "", (),
+    {
+        conoutf("worldstates: %d slabs, %d live, %d peak live, %d pooled, %d allocated, %d grown",
+            worldstates.slabs, worldstates.live, worldstates.peaklive, worldstates.pooled.length(), worldstates.allocs, worldstates.growths);
+    });
+
+    // keeps backlog ticks of worldstate packets unacknowledged by every peer, as a high latency link would, checking that no slab is reused while still referenced
+    static void worldstatebench(int peers, int backlog, int ticks)
+    {
+        peers = clamp(peers, 1, MAXCLIENTS);
+        backlog = clamp(backlog, 1, 10000);
+        ticks = max(ticks, backlog + 1);
+        vector<ENetPacket *> *held = new vector<ENetPacket *>[backlog];
+        int startallocs = worldstates.allocs, startgrowths = worldstates.growths, warmallocs = 0, warmgrowths = 0, corrupt = 0;
+        enet_uint32 start = enet_time_get();
+        loopi(ticks)
+        {
+            vector<ENetPacket *> &slot = held[i%backlog];
+            int stamp = i - backlog;
+            loopvj(slot)
+            {
+                ENetPacket *packet = slot[j];
+                if(memcmp(packet->data, &stamp, sizeof(int))) corrupt++;
+                if(--packet->referenceCount <= 0) enet_packet_destroy(packet);
+            }
+            slot.setsize(0);
+            if(i == backlog) { warmallocs = worldstates.allocs; warmgrowths = worldstates.growths; }
+            int len = 16 + rnd(48);
+            worldstate &ws = *worldstates.get(peers*len);
+            loopj(peers)
+            {
+                uchar *data = &ws.data[j*len];
+                memset(data, j, len);
+                memcpy(data, &i, sizeof(int));
+                ENetPacket *packet = enet_packet_create(data, len, ENET_PACKET_FLAG_NO_ALLOCATE);
+                packet->referenceCount++;
+                holdworldstate(ws, packet);
+                slot.add(packet);
+            }
+        }
+        loopi(backlog)
+        {
+            loopvj(held[i])
+            {
+                ENetPacket *packet = held[i][j];
+                if(--packet->referenceCount <= 0) enet_packet_destroy(packet);
+            }
+        }
+        enet_uint32 elapsed = enet_time_get() - start;
+        delete[] held;
+        conoutf("worldstatebench: %d ticks to %d peers with %d unacked in %u ms (%.3f us per tick)",
+            ticks, peers, backlog, elapsed, elapsed*1000.0f/ticks);
+        conoutf("worldstatebench: %d slabs allocated (%d after warmup), %d grown (%d after warmup), %d peak live, %d still live, %d corrupt",
+            worldstates.allocs - startallocs, worldstates.allocs - warmallocs, worldstates.growths - startgrowths, worldstates.growths - warmgrowths,
+            worldstates.peaklive, worldstates.live, corrupt);
+    }
+    ICOMMAND(worldstatebench, "iii", (int *peers, int *backlog, int *ticks), worldstatebench(*peers ? *peers : 64, *backlog ? *backlog : 128, *ticks ? *ticks : 100000));
+
     template<class T>
     void sendstate(servstate &gs, T &p)
     {
@@ -1949,11 +2653,13 @@ namespace server
     }
 
     int welcomepacket(packetbuf& p, clientinfo* ci);
+    ENetPacket *getwelcomestate();
 
     void sendwelcome(clientinfo *ci)
     {
         if (ci)
         {
+            sendpacket(ci->clientnum, 1, getwelcomestate());
             packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
             int chan = welcomepacket(p, ci);
             sendpacket(ci->clientnum, chan, p.finalize());
@@ -2005,7 +2711,8 @@ namespace server
                (smapname[0] && (!gamelimit || !m_timed || (m_round && !interm) || (gamemillis < gamelimit) || (ci->state.state==CS_SPECTATOR && !ci->privilege && !ci->local) || numclients(ci->clientnum, true, true, true)));
     }
 
-    int welcomedemopacket(packetbuf& p)
+    // everything in a welcome that does not depend on the joining client, sent ahead of the per-client part on the same channel
+    void putwelcomestate(packetbuf &p)
     {
         putint(p, N_WELCOME);
 
@@ -2015,13 +2722,10 @@ namespace server
         putint(p, mutators);
         putint(p, gamescorelimit);
         putint(p, notgotitems ? 1 : 0);
-        putint(p, N_TIMEUP);
-        putint(p, gamewaiting || (gamemillis < gamelimit && !interm) ? max((gamelimit - gamemillis) / 1000, 1) : 0);
-        putint(p, TimeUpdate_Match);
         if (!notgotitems)
         {
             putint(p, N_ITEMLIST);
-            loopv(sents) if (sents[i].spawned)
+            loopv(sents) if(sents[i].spawned)
             {
                 putint(p, i);
                 putint(p, sents[i].type);
@@ -2064,10 +2768,35 @@ namespace server
             putint(p, N_TEAMINFO);
             loopi(MAXTEAMS)
             {
-                teaminfo& t = teaminfos[i];
+                teaminfo &t = teaminfos[i];
                 putint(p, t.frags);
             }
         }
+    }
+
+    // one immutable packet of the shared welcome state, referenced by every peer it is sent to and rebuilt once welcomegen moves
+    ENetPacket *welcomestate = NULL;
+    int welcomestategen = -1;
+
+    ENetPacket *getwelcomestate()
+    {
+        if(welcomestate && welcomestategen == welcomegen) return welcomestate;
+        if(welcomestate && --welcomestate->referenceCount <= 0) enet_packet_destroy(welcomestate);
+        packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+        putwelcomestate(p);
+        welcomestate = p.finalize();
+        welcomestate->referenceCount++;
+        welcomestategen = welcomegen;
+        return welcomestate;
+    }
+
+    int welcomedemopacket(packetbuf& p)
+    {
+        ENetPacket *state = getwelcomestate();
+        p.put(state->data, state->dataLength);
+        putint(p, N_TIMEUP);
+        putint(p, gamewaiting || (gamemillis < gamelimit && !interm) ? max((gamelimit - gamemillis) / 1000, 1) : 0);
+        putint(p, TimeUpdate_Match);
         putint(p, N_RESUME);
         loopv(clients)
         {
@@ -2091,75 +2820,17 @@ namespace server
 
     int welcomepacket(packetbuf &p, clientinfo *ci)
     {
-        putint(p, N_WELCOME);
-
         putint(p, N_COUNTRY);
         putint(p, ci->clientnum);
         sendstring(ci->customflag_code, p);
         sendstring(ci->customflag_name, p);
 
-        putint(p, N_MAPCHANGE);
-        sendstring(smapname, p);
-        putint(p, gamemode);
-        putint(p, mutators);
-        putint(p, gamescorelimit);
-        putint(p, notgotitems ? 1 : 0);
         if (gamelimit && m_timed && smapname[0])
         {
             putint(p, N_TIMEUP);
             putint(p, gamewaiting || (gamemillis < gamelimit && !interm) ? max((gamelimit - gamemillis)/1000, 1) : 0);
             putint(p, TimeUpdate_Match);
         }
-        if (!notgotitems)
-        {
-            putint(p, N_ITEMLIST);
-            loopv(sents) if(sents[i].spawned)
-            {
-                putint(p, i);
-                putint(p, sents[i].type);
-            }
-            putint(p, -1);
-        }
-        bool hasmaster = false;
-        if (mastermode != MM_OPEN)
-        {
-            putint(p, N_CURRENTMASTER);
-            putint(p, mastermode);
-            hasmaster = true;
-        }
-        loopv(clients) if (clients[i]->privilege >= PRIV_MASTER)
-        {
-            if (!hasmaster)
-            {
-                putint(p, N_CURRENTMASTER);
-                putint(p, mastermode);
-                hasmaster = true;
-            }
-            putint(p, clients[i]->clientnum);
-            putint(p, clients[i]->privilege);
-        }
-        if (hasmaster) putint(p, -1);
-        if (gamepaused)
-        {
-            putint(p, N_PAUSEGAME);
-            putint(p, 1);
-            putint(p, -1);
-        }
-        if (gamespeed != 100)
-        {
-            putint(p, N_GAMESPEED);
-            putint(p, gamespeed);
-            putint(p, -1);
-        }
-        if (m_teammode)
-        {
-            putint(p, N_TEAMINFO);
-            loopi(MAXTEAMS)
-            {
-                teaminfo &t = teaminfos[i];
-                putint(p, t.frags);
-            }
-        }
         putint(p, N_SETTEAM);
         putint(p, ci->clientnum);
         putint(p, ci->team);
@@ -2442,6 +3113,7 @@ namespace server
         }
         ci->state.assignrole(ROLE_BERSERKER);
         sendf(-1, 1, "ri4", N_ASSIGNROLE, ci->clientnum, ci->clientnum, ROLE_BERSERKER);
+        scheduleeffect(ci, TIMER_REGENERATION);
         isberserkerdead = false;
     }
 
@@ -2720,6 +3392,7 @@ namespace server
         gamemode = mode;
         mutators = muts;
         gamemillis = 0;
+        resettimers();
         if(m_round)
         {
             rounds = 0;
@@ -2737,6 +3410,7 @@ namespace server
         else gamescorelimit = scorelimit;
         interm = nextexceeded = 0;
         copystring(smapname, s);
+        changewelcome();
         loaditems();
         scores.shrink(0);
         shouldcheckteamkills = false;
@@ -2948,7 +3622,7 @@ namespace server
             actor->state.effectiveness += fragvalue*friends/float(max(enemies, 1));
         }
         teaminfo *t = m_teammode && validteam(actor->team) ? &teaminfos[actor->team-1] : NULL;
-        if(t) t->frags += fragvalue;
+        if(t) { t->frags += fragvalue; changewelcome(); }
         int kflags = 0; // flags = hit flags, kflags = kill flags
         if(!firstblood && target != actor && !isally(target, actor))
         {
@@ -2985,7 +3659,7 @@ namespace server
             if(m_berserker && !m_vampire(mutators) && actor->state.role == ROLE_BERSERKER)
             {
                 actor->state.health = min(actor->state.health + 50, actor->state.maxhealth);
-                sendf(-1, 1, "ri3", N_REGENERATE, actor->clientnum, actor->state.health);
+                sendtyped(-1, 1, true, -1, N_REGENERATE, actor->clientnum, actor->state.health);
             }
         }
         bool hidekillinfo = m_betrayal && actor->state.role == ROLE_TRAITOR; // cover up traitor's kills and display them as suicides in the obituary
@@ -3025,7 +3699,7 @@ namespace server
             sendf(-1, 1, "ri3", N_SCORE, ci->clientnum, ci->state.points);
             ci->state.deaths++;
             if(m_teammode && validteam(ci->team)) t = &teaminfos[ci->team-1];
-            if(t) t->frags += fragvalue;
+            if(t) { t->frags += fragvalue; changewelcome(); }
         }
         sendf(-1, 1, "ri7", N_DIED, ci->clientnum, ci->clientnum, gs.frags, t ? t->frags : 0, -1, 0);
         ci->position.setsize(0);
@@ -3042,7 +3716,7 @@ namespace server
         servstate &ts = target->state;
         ts.dodamage(damage, flags & Hit_Environment? true : false);
         target->state.lastpain = lastmillis;
-        sendf(-1, 1, "rii9i", N_DAMAGE, target->clientnum, actor->clientnum, atk, damage, flags, ts.health, ts.shield, int(to.x*DMF), int(to.y*DMF), int(to.z*DMF));
+        sendtyped(-1, 1, true, -1, N_DAMAGE, target->clientnum, actor->clientnum, atk, damage, flags, ts.health, ts.shield, int(to.x*DMF), int(to.y*DMF), int(to.z*DMF));
         if(target!=actor && damage > 0)
         {
             if(!isally(target, actor))
@@ -3051,7 +3725,7 @@ namespace server
                 if(m_vampire(mutators))
                 {
                     actor->state.health = min(actor->state.health + damage / (actor->state.role == ROLE_BERSERKER ? 2 : 1), actor->state.maxhealth);
-                    sendf(-1, 1, "ri3", N_REGENERATE, actor->clientnum, actor->state.health);
+                    sendtyped(-1, 1, true, -1, N_REGENERATE, actor->clientnum, actor->state.health);
                 }
             }
             else if(!m_teammode && !m_betrayal) dodamage(actor, actor, damage, atk, flags);
@@ -3060,7 +3734,7 @@ namespace server
         else if(!hitpush.iszero())
         {
             ivec v(vec(hitpush).rescale(DNF));
-            sendf(ts.health<=0 ? -1 : target->ownernum, 1, "ri7", N_HITPUSH, target->clientnum, atk, damage, v.x, v.y, v.z);
+            sendtyped(ts.health<=0 ? -1 : target->ownernum, 1, true, -1, N_HITPUSH, target->clientnum, atk, damage, v.x, v.y, v.z);
             target->setpushed();
         }
         if(ts.health<=0 || atk == ATK_INSTA)
@@ -3186,24 +3860,26 @@ namespace server
         }
         else
         {
+            static vector<uchar> valid;
+            checkhits(ci, millis, from, to, atk, hits, valid);
             int totalrays = 0, maxrays = attacks[atk].rays;
             loopv(hits)
             {
                 hitinfo &h = hits[i];
                 clientinfo *target = getinfo(h.target);
-                if(!target || target->state.state!=CS_ALIVE || h.lifesequence!=target->state.lifesequence || h.rays<1 || h.dist > attacks[atk].range + 1) continue;
+                if(!target || target->state.state!=CS_ALIVE || h.lifesequence!=target->state.lifesequence || h.rays<1 || h.dist > attacks[atk].range + 1 || !valid[i]) continue;
 
                 totalrays += h.rays;
                 if(totalrays>maxrays) continue;
                 int raydamage = h.rays*attacks[atk].damage, damage = calculatedamage(raydamage, target, ci, atk, h.flags);
                 dodamage(target, ci, damage, atk, h.flags, h.dir, to);
                 hit = true;
-                sendf(-1, 1, "rii9ix", N_SHOTFX, ci->clientnum, atk, id, hit, int(from.x*DMF), int(from.y*DMF), int(from.z*DMF), int(to.x*DMF), int(to.y*DMF), int(to.z*DMF), ci->ownernum);
+                sendtyped(-1, 1, true, ci->ownernum, N_SHOTFX, ci->clientnum, atk, id, hit, int(from.x*DMF), int(from.y*DMF), int(from.z*DMF), int(to.x*DMF), int(to.y*DMF), int(to.z*DMF));
 
             }
         }
         if(hit) return;
-        sendf(-1, 1, "rii9ix", N_SHOTFX, ci->clientnum, atk, id, hit, int(from.x*DMF), int(from.y*DMF), int(from.z*DMF), int(to.x*DMF), int(to.y*DMF), int(to.z*DMF), ci->ownernum);
+        sendtyped(-1, 1, true, ci->ownernum, N_SHOTFX, ci->clientnum, atk, id, hit, int(from.x*DMF), int(from.y*DMF), int(from.z*DMF), int(to.x*DMF), int(to.y*DMF), int(to.z*DMF));
     }
 
     void pickupevent::process(clientinfo *ci)
@@ -3232,38 +3908,73 @@ namespace server
 
     void clearevent(clientinfo *ci)
     {
-        delete ci->events.remove(0);
+        ci->events.popfront()->release();
     }
 
     void flushevents(clientinfo *ci, int millis)
     {
-        while(ci->events.length())
+        while(!ci->events.empty())
         {
             gameevent *ev = ci->events[0];
             if(ev->flush(ci, millis)) clearevent(ci);
             else break;
         }
+        scheduleevents(ci);
     }
 
-    VAR(inactivitytime, 60000, 60000, 300000);
+    VARF(inactivitytime, 60000, 60000, 300000, loopv(clients) scheduleeffect(clients[i], TIMER_INACTIVITY));
 
-    void processevents()
+    // lastmillis by which a periodic effect next needs to look at an alive player, or -1 if it never will
+    int effectdeadline(clientinfo *ci, int kind)
     {
-        loopv(clients)
+        servstate &gs = ci->state;
+        if(gs.state != CS_ALIVE) return -1;
+        switch(kind)
         {
-            clientinfo *ci = clients[i];
-            flushevents(ci, gamemillis);
-            if(ci->state.poweruptype && ci->state.powerupmillis)
+            case TIMER_INACTIVITY:
+                if(ci->local || m_edit || (gs.aitype != AI_NONE && !m_round)) return -1;
+                return gs.lastmove + inactivitytime;
+
+            case TIMER_REGENERATION:
             {
-                ci->state.powerupmillis = max(ci->state.powerupmillis - curtime, 0);
-                if(!ci->state.powerupmillis)
+                int deadline = -1;
+                if(!(gs.role == ROLE_BERSERKER || gs.role == ROLE_ZOMBIE) && gs.health > gs.maxhealth) deadline = gs.lastregeneration + 1001;
+                if((m_berserker && gs.role == ROLE_BERSERKER) || m_vampire(mutators))
                 {
-                    ci->state.powerupmillis = 0;
-                    ci->state.poweruptype = PU_NONE;
+                    int drain = max(gs.lastpain + 2801, gs.lastregeneration + 1001);
+                    if(deadline < 0 || drain < deadline) deadline = drain;
                 }
+                return deadline;
             }
-            if(ci->state.state == CS_ALIVE)
+
+            case TIMER_ENVIRONMENT:
             {
+                if(!ci->damagemat) return -1;
+                int deadline = gs.lastdamage + DELAY_ENVIRONMENT_DAMAGE;
+                if(gs.haspowerup(PU_INVULNERABILITY)) deadline = max(deadline, lastmillis + gs.powerupmillis);
+                return deadline;
+            }
+        }
+        return -1;
+    }
+
+    void scheduleeffect(clientinfo *ci, int kind)
+    {
+        int deadline = effectdeadline(ci, kind);
+        if(deadline >= 0) scheduletimer(ci, kind, gamemillis + max(deadline - lastmillis, 1));
+    }
+
+    void scheduleeffects(clientinfo *ci)
+    {
+        for(int kind = TIMER_EVENTS+1; kind < NUMTIMERS; kind++) scheduleeffect(ci, kind);
+    }
+
+    void runeffect(clientinfo *ci, int kind)
+    {
+        if(ci->state.state != CS_ALIVE) return;
+        switch(kind)
+        {
+            case TIMER_INACTIVITY:
                 if(!ci->local && !m_edit && lastmillis - ci->state.lastmove >= inactivitytime)
                 { // basic inactivity check
                     if(ci->state.aitype == AI_NONE)
@@ -3274,11 +3985,14 @@ namespace server
                     }
                     else if(m_round) suicide(ci);
                 }
+                break;
+
+            case TIMER_REGENERATION:
                 if(!(ci->state.role == ROLE_BERSERKER || ci->state.role == ROLE_ZOMBIE) // zombies and berserker are unaffected by this
                    && ci->state.health > ci->state.maxhealth && lastmillis - ci->state.lastregeneration > 1000)
                 {
                     ci->state.health = max(ci->state.health - 1, ci->state.maxhealth);
-                    sendf(-1, 1, "ri3", N_REGENERATE, ci->clientnum, ci->state.health);
+                    sendtyped(-1, 1, true, -1, N_REGENERATE, ci->clientnum, ci->state.health);
                     ci->state.lastregeneration = lastmillis;
                 }
                 if((m_berserker && ci->state.role == ROLE_BERSERKER) || m_vampire(mutators))
@@ -3287,11 +4001,14 @@ namespace server
                     {
                         int subtract = ci->state.role == ROLE_BERSERKER ? 5 : 1;
                         ci->state.health = max(ci->state.health-subtract, 0);
-                        sendf(-1, 1, "ri3", N_REGENERATE, ci->clientnum, ci->state.health);
+                        sendtyped(-1, 1, true, -1, N_REGENERATE, ci->clientnum, ci->state.health);
                         if(ci->state.health<=0) suicide(ci);
                         ci->state.lastregeneration = lastmillis;
                     }
                 }
+                break;
+
+            case TIMER_ENVIRONMENT:
                 if(ci->damagemat)
                 {
                     if(lastmillis-ci->state.lastdamage >= DELAY_ENVIRONMENT_DAMAGE && !ci->state.haspowerup(PU_INVULNERABILITY))
@@ -3300,8 +4017,34 @@ namespace server
                         ci->state.lastdamage = lastmillis;
                     }
                 }
-            }
+                break;
+        }
+        scheduleeffect(ci, kind);
+    }
 
+    void processevents()
+    {
+        // only clients with a queued event or a periodic effect falling due are visited
+        while(servertimers.length() && servertimers[0].due <= gamemillis)
+        {
+            servertimer t = removetimer();
+            if(!t.ci || t.ci->timerdue[t.kind] != t.due) { timerstats.stale++; continue; }
+            t.ci->timerdue[t.kind] = -1;
+            timerstats.fired++;
+            if(t.kind == TIMER_EVENTS) flushevents(t.ci, gamemillis);
+            else runeffect(t.ci, t.kind);
+        }
+        loopv(powerupclients)
+        {
+            servstate &gs = powerupclients[i]->state;
+            if(gs.poweruptype && gs.powerupmillis)
+            {
+                gs.powerupmillis = max(gs.powerupmillis - curtime, 0);
+                if(gs.powerupmillis) continue;
+                gs.poweruptype = PU_NONE;
+            }
+            powerupclients[i]->powerupticking = false;
+            powerupclients.remove(i--);
         }
         serverevents::process();
     }
@@ -3309,22 +4052,15 @@ namespace server
     void cleartimedevents(clientinfo *ci)
     {
         int keep = 0;
-        loopv(ci->events)
+        loopi(ci->events.length())
         {
-            if(ci->events[i]->keepable())
-            {
-                if(keep < i)
-                {
-                    for(int j = keep; j < i; j++) delete ci->events[j];
-                    ci->events.remove(keep, i - keep);
-                    i = keep;
-                }
-                keep = i+1;
-                continue;
-            }
+            gameevent *ev = ci->events[i];
+            if(ev->keepable()) ci->events[keep++] = ev;
+            else ev->release();
         }
-        while(ci->events.length() > keep) delete ci->events.pop();
+        ci->events.setsize(keep);
         ci->timesync = false;
+        scheduleevents(ci);
     }
 
     bool remainingminutes(int remaining, int oldgamemillis)
@@ -3336,10 +4072,14 @@ namespace server
 
     void serverupdate()
     {
+        eventstats.tick();
+        checkdemowriter();
+        loopv(clients) senddemochunk(clients[i]);
         if(shouldstep && !gamepaused)
         {
             int oldgamemillis = gamemillis;
             gamemillis += curtime;
+            recordlagcomp();
 
             if(gamelimit && m_timed)
             {
@@ -3356,7 +4096,10 @@ namespace server
             if(m_demo) readdemo();
             else if(!gamelimit || !m_timed || (m_round && !interm) || gamemillis < gamelimit)
             {
-                processevents();
+                {
+                    tickscope scope(TICK_EVENTS);
+                    processevents();
+                }
                 if(curtime)
                 {
                     loopv(sents) if(sents[i].spawntime) // spawn entities when timer reached
@@ -3366,12 +4109,20 @@ namespace server
                         {
                             sents[i].spawntime = 0;
                             sents[i].spawned = true;
+                            changewelcome();
                             sendf(-1, 1, "ri2", N_ITEMSPAWN, i);
                         }
                     }
                 }
-                aimanager::checkai();
-                if(smode) smode->update();
+                {
+                    tickscope scope(TICK_AI);
+                    aimanager::checkai();
+                }
+                if(smode)
+                {
+                    tickscope scope(TICK_MODE);
+                    smode->update();
+                }
             }
 
             if(!interm)
@@ -3423,6 +4174,38 @@ namespace server
         shouldstep = clients.length() > 0;
     }
 
+    void writemetrics(vector<char> &buf)
+    {
+        int players = 0, spectators = 0, bots = 0, queued = 0, maxqueued = 0;
+        loopv(clients)
+        {
+            clientinfo *ci = clients[i];
+            if(ci->state.aitype != AI_NONE) bots++;
+            else if(ci->state.state == CS_SPECTATOR) spectators++;
+            else players++;
+            queued += ci->events.length();
+            maxqueued = max(maxqueued, ci->events.length());
+        }
+        metricf(buf, "valhalla_players{type=\"player\"} %d", players);
+        metricf(buf, "valhalla_players{type=\"spectator\"} %d", spectators);
+        metricf(buf, "valhalla_players{type=\"bot\"} %d", bots);
+        metricf(buf, "valhalla_connecting_clients %d", connects.length());
+        metricf(buf, "valhalla_event_queue_depth %d", queued);
+        metricf(buf, "valhalla_event_queue_max_depth %d", maxqueued);
+        metricf(buf, "valhalla_event_allocations_total %d", eventstats.allocs);
+        metricf(buf, "valhalla_event_reuses_total %d", eventstats.reuses);
+        loopi(NUMMSG) if(msgcounts[i]) metricf(buf, "valhalla_received_messages_total{type=\"%d\"} %u", i, msgcounts[i]);
+        metricf(buf, "valhalla_lagcomp_checked_total %d", lagcompchecked);
+        metricf(buf, "valhalla_lagcomp_rejected_total %d", lagcomprejected);
+        metricf(buf, "valhalla_demo_recording %d", demorecord ? 1 : 0);
+        metricf(buf, "valhalla_demo_recording_bytes %d", demorecord && atomicload(demowrite.writing) == demoid ? atomicload(demowrite.written) : 0);
+        metricf(buf, "valhalla_demo_writer_jobs %d", demojobs);
+        metricf(buf, "valhalla_demos %d", demos.length());
+        metricf(buf, "valhalla_demo_store_bytes %lld", demostorebytes());
+        metricf(buf, "valhalla_game_millis %d", gamemillis);
+        metricf(buf, "valhalla_paused %d", gamepaused ? 1 : 0);
+    }
+
     void forcespectator(clientinfo *ci)
     {
         if(ci->state.state==CS_ALIVE) suicide(ci);
@@ -3589,21 +4372,18 @@ namespace server
 
     struct banlist
     {
-        vector<ipmask> bans;
+        ipmaskset bans;
 
-        void clear() { bans.shrink(0); }
+        void clear() { bans.clear(); }
 
         bool check(uint ip)
         {
-            loopv(bans) if(bans[i].check(ip)) return true;
-            return false;
+            return bans.check(ip);
         }
 
         void add(const char *ipname)
         {
-            ipmask ban;
-            ban.parse(ipname);
-            bans.add(ban);
+            bans.add(ipname);
 
             verifybans();
         }
@@ -3628,6 +4408,47 @@ namespace server
     ICOMMAND(clearipbans, "", (), ipbans.clear());
     ICOMMAND(ipban, "s", (const char *ipname), ipbans.add(ipname));
 
+    // times ban checks against a random ban list through the trie and through a linear scan of the same masks
+    static void ipbanbench(int entries, int lookups)
+    {
+        entries = max(entries, 1);
+        lookups = max(lookups, 1);
+        vector<ipmask> masks;
+        loopi(entries)
+        {
+            ipmask &m = masks.add();
+            int range = i%8 ? 24 + rnd(9) : 16 + rnd(8);
+            m.mask = ENET_HOST_TO_NET_32(0xFFFFFFFFU << (32 - range));
+            m.ip = (uint(rnd(0x10000)) | (uint(rnd(0x10000)) << 16)) & m.mask;
+        }
+        vector<uint> hosts;
+        loopi(lookups) hosts.add(i%4 ? uint(rnd(0x10000)) | (uint(rnd(0x10000)) << 16) : masks[rnd(entries)].ip);
+        ipmaskset set;
+        uint start = getservermicros();
+        set.build(masks);
+        uint buildtime = getservermicros() - start;
+        int found = 0, agree = 0;
+        start = getservermicros();
+        loopv(hosts) if(set.check(hosts[i])) found++;
+        uint trietime = getservermicros() - start;
+        // the scan is slow enough at these sizes that only a sample of the lookups is timed
+        int scanlookups = clamp(100000000/entries, 100, lookups);
+        vector<uchar> scanned;
+        scanned.pad(scanlookups);
+        start = getservermicros();
+        loopi(scanlookups)
+        {
+            scanned[i] = 0;
+            loopvj(masks) if(masks[j].check(hosts[i])) { scanned[i] = 1; break; }
+        }
+        uint scantime = getservermicros() - start;
+        loopi(scanlookups) if(set.check(hosts[i]) == (scanned[i] != 0)) agree++;
+        conoutf("ipbanbench: %d bans in %d trie nodes built in %.3f ms", entries, set.nodes.length(), buildtime/1000.0f);
+        conoutf("ipbanbench: trie %d lookups in %.3f ms (%.1f ns each, %d banned), scan %.1f ns each, %d/%d agree",
+            lookups, trietime/1000.0f, trietime*1000.0f/lookups, found, scantime*1000.0f/scanlookups, agree, scanlookups);
+    }
+    ICOMMAND(ipbanbench, "ii", (int *entries, int *lookups), ipbanbench(*entries ? *entries : 100000, *lookups ? *lookups : 1000000));
+
     int allowconnect(clientinfo *ci, const char *pwd = "")
     {
         if(ci->local) return DISC_NONE;
@@ -3952,26 +4773,14 @@ namespace server
         {
             case N_POS:
             {
-                int pcn = getuint(p);
-                p.get();
-                uint flags = getuint(p);
-                clientinfo *cp = getinfo(pcn);
-                if(cp && pcn != sender && cp->ownernum != sender) cp = NULL;
+                posstate ps;
+                ps.parse(p);
+                clientinfo *cp = getinfo(ps.cn);
+                if(cp && ps.cn != sender && cp->ownernum != sender) cp = NULL;
                 vec pos;
-                loopk(3)
-                {
-                    int n = p.get(); n |= p.get()<<8; if(flags&(1<<k)) { n |= p.get()<<16; if(n&0x800000) n |= ~0U<<24; }
-                    pos[k] = n/DMF;
-                }
-                loopk(3) p.get();
-                int mag = p.get(); if(flags&(1<<3)) mag |= p.get()<<8;
-                int dir = p.get(); dir |= p.get()<<8;
-                vec vel = vec((dir%360)*RAD, (clamp(dir/360, 0, 180)-90)*RAD).mul(mag/DVELF);
-                if(flags&(1<<4))
-                {
-                    p.get(); if(flags&(1<<5)) p.get();
-                    if(flags&(1<<6)) loopk(2) p.get();
-                }
+                loopk(3) pos[k] = ps.vals[POS_X+k]/DMF;
+                int dir = ps.vals[POS_VELDIR];
+                vec vel = vec((dir%360)*RAD, (clamp(dir/360, 0, 180)-90)*RAD).mul(ps.vals[POS_VEL]/DVELF);
                 if(cp)
                 {
                     if((!ci->local || demorecord || hasnonlocalclients()) && (cp->state.state==CS_ALIVE || cp->state.state==CS_EDITING))
@@ -3980,15 +4789,26 @@ namespace server
                             cp->setexceeded();
                         cp->position.setsize(0);
                         while(curmsg<p.length()) cp->position.add(p.buf[curmsg++]);
+                        cp->pos = ps;
                     }
                     cp->state.oldpos = cp->state.o;
                     cp->state.o = pos;
                     if(cp->state.oldpos != cp->state.o) cp->state.lastmove = lastmillis;
-                    cp->damagemat = (flags&0x80)!=0;
+                    cp->damagemat = (ps.vals[POS_FLAGS]&0x80)!=0;
+                    if(cp->damagemat) scheduleeffect(cp, TIMER_ENVIRONMENT);
                 }
                 break;
             }
 
+            case N_POSACK:
+            {
+                int ack = getint(p);
+                if(ack == -1) { if(allowposdelta) ci->resetposdelta(true); }
+                else if(ack < -1) ci->resetposdelta(false);
+                else if(ci->posdelta && ack > ci->posack && ack <= ci->posseq) ci->ackposframe(ack);
+                break;
+            }
+
             case N_TELEPORT:
             {
                 int pcn = getint(p), teleport = getint(p), teledest = getint(p);
@@ -4049,10 +4869,14 @@ namespace server
                 {
                     ci->state.editstate = ci->state.state;
                     ci->state.state = CS_EDITING;
-                    ci->events.deletecontents();
+                    clearevents(ci->events);
                     ci->state.projectiles.reset();
                 }
-                else ci->state.state = ci->state.editstate;
+                else
+                {
+                    ci->state.state = ci->state.editstate;
+                    scheduleeffects(ci);
+                }
                 QUEUE_MSG;
                 break;
             }
@@ -4135,6 +4959,7 @@ namespace server
                 cq->state.state = CS_ALIVE;
                 cq->state.gunselect = gunselect;
                 cq->exceeded = 0;
+                scheduleeffects(cq);
                 if(smode) smode->spawned(cq);
                 QUEUE_AI;
                 QUEUE_BUF({
@@ -4146,13 +4971,14 @@ namespace server
 
             case N_SUICIDE:
             {
-                if(cq) cq->addevent(new suicideevent);
+                if(cq) cq->addevent(suicideevents.alloc());
                 break;
             }
 
             case N_SHOOT:
             {
-                shotevent *shot = new shotevent;
+                shotevent *shot = shotevents.alloc();
+                int hitcap = shot->hits.capacity();
                 shot->id = getint(p);
                 shot->millis = cq ? cq->geteventmillis(gamemillis, shot->id) : 0;
                 shot->atk = getint(p);
@@ -4170,18 +4996,20 @@ namespace server
                     hit.flags = getint(p);
                     loopk(3) hit.dir[k] = getint(p)/DNF;
                 }
+                if(shot->hits.capacity() > hitcap) eventstats.hitgrowths++;
                 if(cq)
                 {
                     cq->addevent(shot);
                     cq->setpushed();
                 }
-                else delete shot;
+                else shot->release();
                 break;
             }
 
             case N_EXPLODE:
             {
-                explodeevent *exp = new explodeevent;
+                explodeevent *exp = explodeevents.alloc();
+                int hitcap = exp->hits.capacity();
                 int cmillis = getint(p);
                 exp->millis = cq ? cq->geteventmillis(gamemillis, cmillis) : 0;
                 exp->atk = getint(p);
@@ -4198,8 +5026,9 @@ namespace server
                     hit.flags = getint(p);
                     loopk(3) hit.dir[k] = getint(p)/DNF;
                 }
+                if(exp->hits.capacity() > hitcap) eventstats.hitgrowths++;
                 if(cq) cq->addevent(exp);
-                else delete exp;
+                else exp->release();
                 break;
             }
 
@@ -4207,7 +5036,7 @@ namespace server
             {
                 int n = getint(p);
                 if(!cq) break;
-                pickupevent *pickup = new pickupevent;
+                pickupevent *pickup = pickupevents.alloc();
                 pickup->ent = n;
                 cq->addevent(pickup);
                 break;
@@ -4331,6 +5160,7 @@ namespace server
                     }
                 }
                 notgotitems = false;
+                changewelcome();
                 break;
             }
 
@@ -4352,6 +5182,7 @@ namespace server
                     {
                         sents[i].spawntime = canspawn ? 1 : 0;
                         sents[i].spawned = false;
+                        changewelcome();
                     }
                 }
                 break;
@@ -4396,6 +5227,7 @@ namespace server
                     {
                         mastermode = mm;
                         allowedips.shrink(0);
+                        changewelcome();
                         if(mm>=MM_PRIVATE)
                         {
                             loopv(clients) allowedips.add(getclientip(clients[i]->clientnum));
@@ -4539,6 +5371,7 @@ namespace server
                     smapname[0] = '\0';
                     resetitems();
                     notgotitems = false;
+                    changewelcome();
                     if(smode) smode->newmap();
                 }
                 QUEUE_MSG;
@@ -4765,6 +5598,7 @@ namespace server
     int masterport() { return VALHALLA_MASTER_PORT; }
     int numchannels() { return 3; }
 
+    #include "demoreplay.h"
     #include "extinfo.h"
 
     void serverinforeply(ucharbuf &req, ucharbuf &p)
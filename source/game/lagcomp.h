@@ -0,0 +1,246 @@
+// lag compensation: a short history of player positions that reported hits are checked against
+
+#define LAGCOMPSLOTS (MAXCLIENTS + MAXBOTS)
+#define LAGCOMPFRAMES 128
+#define LAGCOMPDEAD 0xFF
+
+VAR(lagcomp, 0, 1, 1);
+VAR(lagcompinterval, 1, 8, 100);
+VAR(lagcompmaxrewind, 0, 500, 1000);
+VAR(lagcomptolerance, 0, 8, 64);
+
+// positions of every slot at one point in time, stored as separate coordinate arrays
+struct lagcompframe
+{
+    int millis;
+    float x[LAGCOMPSLOTS], y[LAGCOMPSLOTS], z[LAGCOMPSLOTS];
+    uchar lifesequence[LAGCOMPSLOTS];
+
+    void clear(int n)
+    {
+        millis = n;
+        memset(lifesequence, LAGCOMPDEAD, sizeof(lifesequence));
+    }
+
+    void set(int slot, const vec &o, int ls)
+    {
+        x[slot] = o.x;
+        y[slot] = o.y;
+        z[slot] = o.z;
+        lifesequence[slot] = ls;
+    }
+};
+
+// rewound targets of one shot, packed so the capsule test runs over contiguous arrays
+struct lagcomptargets
+{
+    vector<float> x, y, z;
+
+    void reset() { x.setsize(0); y.setsize(0); z.setsize(0); }
+    void add(float px, float py, float pz) { x.add(px); y.add(py); z.add(pz); }
+    void add(const vec &o) { add(o.x, o.y, o.z); }
+    int length() const { return x.length(); }
+};
+
+struct lagcomphistory
+{
+    lagcompframe frames[LAGCOMPFRAMES];
+    int numframes, head;
+
+    lagcomphistory() { clear(); }
+
+    void clear() { numframes = head = 0; }
+
+    lagcompframe &add(int millis)
+    {
+        head = (head + 1) % LAGCOMPFRAMES;
+        numframes = min(numframes + 1, LAGCOMPFRAMES);
+        lagcompframe &f = frames[head];
+        f.clear(millis);
+        return f;
+    }
+
+    void record(int millis)
+    {
+        if(numframes)
+        {
+            int last = frames[head].millis;
+            if(millis < last) clear();
+            else if(millis - last < lagcompinterval) return;
+        }
+        lagcompframe &f = add(millis);
+        loopv(clients)
+        {
+            clientinfo *ci = clients[i];
+            if(ci->clientnum >= 0 && ci->clientnum < LAGCOMPSLOTS && ci->state.state == CS_ALIVE)
+                f.set(ci->clientnum, ci->state.o, ci->state.lifesequence);
+        }
+    }
+
+    // finds the frames bracketing millis, newest first, returning the blend weight of the older one
+    float bracket(int millis, const lagcompframe *&older, const lagcompframe *&newer) const
+    {
+        older = newer = NULL;
+        loopi(numframes)
+        {
+            const lagcompframe &f = frames[(head - i + LAGCOMPFRAMES) % LAGCOMPFRAMES];
+            if(f.millis <= millis)
+            {
+                older = &f;
+                break;
+            }
+            newer = &f;
+        }
+        if(!older || !newer || newer->millis <= older->millis) return 1;
+        return float(newer->millis - millis) / float(newer->millis - older->millis);
+    }
+
+    // appends the position of slot at the bracketed time, or cur if the slot was not alive in that life
+    void rewind(const lagcompframe *older, const lagcompframe *newer, float t, int slot, int ls, const vec &cur, lagcomptargets &out) const
+    {
+        if(ls < 0 || ls >= LAGCOMPDEAD) { out.add(cur); return; }
+        bool hasold = older && older->lifesequence[slot] == ls, hasnew = newer && newer->lifesequence[slot] == ls;
+        if(hasold && hasnew)
+            out.add(newer->x[slot] + (older->x[slot] - newer->x[slot])*t,
+                    newer->y[slot] + (older->y[slot] - newer->y[slot])*t,
+                    newer->z[slot] + (older->z[slot] - newer->z[slot])*t);
+        else if(hasold) out.add(older->x[slot], older->y[slot], older->z[slot]);
+        else if(hasnew) out.add(newer->x[slot], newer->y[slot], newer->z[slot]);
+        else out.add(cur);
+    }
+};
+
+// tests the segment from + dir*[0, range] against upright player capsules standing at the given feet positions,
+// allowing the spread of multi-ray weapons to widen the radius with distance
+static void lagcompcapsules(const vec &from, const vec &dir, float range, float spread, const lagcomptargets &targets, uchar *hit)
+{
+    const float radius = 4.1f, height = 15.5f + 2.0f, axis = height - 2*radius;
+    const float a = range*range, e = axis*axis, b = axis*dir.z*range;
+    const float denom = a*e - b*b, tolerance = radius + lagcomptolerance, widen = 0.5f*spread*range/1024;
+    const float *tx = targets.x.getbuf(), *ty = targets.y.getbuf(), *tz = targets.z.getbuf();
+    int n = targets.length();
+    for(int i = 0; i < n; i++)
+    {
+        // closest points between the shot segment and the capsule axis
+        float rx = from.x - tx[i], ry = from.y - ty[i], rz = from.z - (tz[i] + radius);
+        float c = range*(dir.x*rx + dir.y*ry + dir.z*rz), f = axis*rz;
+        float s = denom > 1e-6f ? clamp((b*f - c*e)/denom, 0.0f, 1.0f) : 0.0f;
+        float t = (b*s + f)/e;
+        float sclamped = t < 0 ? clamp(-c/a, 0.0f, 1.0f) : clamp((b - c)/a, 0.0f, 1.0f);
+        s = t < 0 || t > 1 ? sclamped : s;
+        t = clamp(t, 0.0f, 1.0f);
+        float dx = rx + dir.x*range*s, dy = ry + dir.y*range*s, dz = rz + dir.z*range*s - axis*t;
+        float maxdist = tolerance + widen*s;
+        hit[i] = dx*dx + dy*dy + dz*dz <= maxdist*maxdist ? 1 : 0;
+    }
+}
+
+lagcomphistory lagcomphist;
+int lagcompchecked = 0, lagcomprejected = 0;
+
+static void recordlagcomp()
+{
+    if(lagcomp) lagcomphist.record(gamemillis);
+}
+
+// resolves a hit target to its current position, or NULL if it cannot be checked
+typedef const vec *(*lagcomptarget)(int cn);
+
+static const vec *clienttarget(int cn)
+{
+    clientinfo *ci = getinfo(cn);
+    return ci ? &ci->state.o : NULL;
+}
+
+static void checklagcomp(const lagcomphistory &hist, lagcomptarget gettarget, int millis, const vec &from, const vec &to, int atk, const vector<hitinfo> &hits, vector<uchar> &valid)
+{
+    static lagcomptargets targets;
+    static vector<int> indices;
+    static vector<uchar> results;
+    valid.setsize(0);
+    loopv(hits) valid.add(1);
+    if(!lagcomp || !hits.length() || !validatk(atk)) return;
+    vec dir = vec(to).sub(from);
+    float len = dir.magnitude();
+    if(len <= 0) return;
+    dir.div(len);
+    const lagcompframe *older, *newer;
+    float t = hist.bracket(millis, older, newer);
+    targets.reset();
+    indices.setsize(0);
+    loopv(hits)
+    {
+        const hitinfo &h = hits[i];
+        const vec *cur = h.target >= 0 && h.target < LAGCOMPSLOTS ? gettarget(h.target) : NULL;
+        if(!cur) continue;
+        hist.rewind(older, newer, t, h.target, h.lifesequence, *cur, targets);
+        indices.add(i);
+    }
+    results.setsize(0);
+    results.pad(targets.length());
+    lagcompcapsules(from, dir, max(float(attacks[atk].range), len), attacks[atk].rays > 1 ? attacks[atk].spread : 0, targets, results.getbuf());
+    loopv(indices) if(!results[i]) valid[indices[i]] = 0;
+}
+
+static void checkhits(clientinfo *ci, int millis, const vec &from, const vec &to, int atk, const vector<hitinfo> &hits, vector<uchar> &valid)
+{
+    int rewind = millis - clamp(ci->ping, 0, lagcompmaxrewind);
+    checklagcomp(lagcomphist, clienttarget, rewind, from, to, atk, hits, valid);
+    lagcompchecked += valid.length();
+    loopv(valid) if(!valid[i]) lagcomprejected++;
+}
+
+ICOMMAND(lagcompstats, "", (),
+{
+    conoutf("lag compensation: %d hits checked, %d rejected, %d frames of history", lagcompchecked, lagcomprejected, lagcomphist.numframes);
+});
+
+static vec lagcompbenchpos[LAGCOMPSLOTS];
+
+static const vec *benchtarget(int cn) { return &lagcompbenchpos[cn]; }
+
+// times shot validation against a synthetic history of moving players
+static void lagcompbench(int players, int shots)
+{
+    players = clamp(players, 1, LAGCOMPSLOTS);
+    shots = max(shots, 1);
+    lagcomphistory *hist = new lagcomphistory;
+    vec *pos = lagcompbenchpos;
+    loopi(players) pos[i] = vec(rndscale(1024), rndscale(1024), rndscale(64));
+    loopj(LAGCOMPFRAMES)
+    {
+        lagcompframe &f = hist->add(j*lagcompinterval);
+        loopi(players)
+        {
+            pos[i].add(vec(rndscale(4)-2, rndscale(4)-2, 0));
+            f.set(i, pos[i], 0);
+        }
+    }
+    vector<hitinfo> hits;
+    vector<uchar> valid;
+    int atk = ATK_SCATTER1, passed = 0, span = LAGCOMPFRAMES*lagcompinterval;
+    enet_uint32 start = enet_time_get();
+    loopi(shots)
+    {
+        hits.setsize(0);
+        int millis = rnd(span), target = rnd(players);
+        loopk(min(players, 4))
+        {
+            hitinfo &h = hits.add();
+            h.target = (target + k) % players;
+            h.lifesequence = 0;
+            h.rays = 1;
+            h.flags = 0;
+            h.dist = 0;
+            h.dir = vec(0, 0, 0);
+        }
+        vec to = vec(pos[target]).add(vec(0, 0, 8)), from = vec(to).add(vec(rndscale(256)-128, rndscale(256)-128, rndscale(32)));
+        checklagcomp(*hist, benchtarget, millis, from, to, atk, hits, valid);
+        loopvk(valid) if(valid[k]) passed++;
+    }
+    enet_uint32 elapsed = enet_time_get() - start;
+    delete hist;
+    conoutf("lagcompbench: %d shots at %d players in %u ms (%.3f us per shot, %d hits accepted)",
+        shots, players, elapsed, elapsed*1000.0f/shots, passed);
+}
+ICOMMAND(lagcompbench, "ii", (int *players, int *shots), lagcompbench(*players ? *players : 32, *shots ? *shots : 100000));
@@ -0,0 +1,504 @@
+// loadtest.cpp: headless swarm of scripted clients for measuring a dedicated server under load
+
+#include "game.h"
+
+void fatal(const char *fmt, ...)
+{
+    defvformatstring(msg, fmt, fmt);
+    fprintf(stderr, "loadtest error: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+void conoutfv(int type, const char *fmt, va_list args)
+{
+    vprintf(fmt, args);
+    putchar('\n');
+}
+
+namespace loadtest
+{
+    enum { PAT_CIRCLE = 0, PAT_STRAFE, PAT_FIGURE8, PAT_WANDER, NUMPATTERNS };
+
+    static const int NUMCHANNELS = 3; // must match server::numchannels()
+
+    static const char * const patternnames[NUMPATTERNS] = { "circle", "strafe", "figure8", "wander" };
+
+    string host = "127.0.0.1";
+    int port = VALHALLA_SERVER_PORT, numclients = 16, duration = 30, posrate = 40, shotrate = 500, textrate = 5000, pingrate = 1000;
+    bool posdelta = false;
+
+    static uint getmicros()
+    {
+#ifdef WIN32
+        static LARGE_INTEGER freq = { { 0, 0 } };
+        if(!freq.QuadPart) QueryPerformanceFrequency(&freq);
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        return uint(counter.QuadPart*1000000/freq.QuadPart);
+#else
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint(ts.tv_sec*1000000ULL + ts.tv_nsec/1000);
+#endif
+    }
+
+    struct loadclient
+    {
+        ENetPeer *peer;
+        int num, cn, lifesequence, gunselect, pattern;
+        bool connected, joined, alive;
+        vec center, o, vel;
+        float yaw, radius, speed;
+        uint start, lastpos, lastshot, lasttext, lastping, lastspawn, lastworld;
+        ullong sent, received;
+        vector<int> rtts, ticks;
+
+        loadclient(int n) : peer(NULL), num(n), cn(-1), lifesequence(0), gunselect(GUN_PISTOL), pattern(n%NUMPATTERNS),
+            connected(false), joined(false), alive(false), o(0, 0, 0), vel(0, 0, 0), yaw(0),
+            start(0), lastpos(0), lastshot(0), lasttext(0), lastping(0), lastspawn(0), lastworld(0), sent(0), received(0)
+        {
+            // spread the swarm over a grid so relevance culling sees a mix of near and far players
+            center = vec(512 + (n%8)*96, 512 + ((n/8)%8)*96, 520);
+            radius = 48 + rnd(64);
+            speed = 0.8f + rndscale(0.8f);
+        }
+
+        void send(int chan, packetbuf &p)
+        {
+            sent += p.length();
+            enet_peer_send(peer, chan, p.finalize());
+        }
+
+        // scripted movement, t is in seconds since the client joined
+        void move(float t)
+        {
+            vec prev = o;
+            float a = t*speed;
+            switch(pattern)
+            {
+                case PAT_CIRCLE: o = vec(center.x + cosf(a)*radius, center.y + sinf(a)*radius, center.z); break;
+                case PAT_STRAFE: o = vec(center.x + sinf(a*2)*radius, center.y, center.z); break;
+                case PAT_FIGURE8: o = vec(center.x + sinf(a)*radius, center.y + sinf(a*2)*radius/2, center.z); break;
+                case PAT_WANDER:
+                    if(o.iszero()) o = center;
+                    yaw += rndscale(30) - 15;
+                    o.add(vec(yaw*RAD, 0).mul(posrate*0.1f));
+                    if(o.dist2(center) > radius*2) yaw += 180;
+                    break;
+            }
+            vel = vec(o).sub(prev).mul(1000.0f/posrate);
+            if(pattern != PAT_WANDER && vel.magnitude2() > 0) yaw = atan2f(vel.y, vel.x)/RAD - 90;
+        }
+
+        static uint packdir(float yaw, float pitch)
+        {
+            int y = int(yaw)%360;
+            return (y < 0 ? y + 360 : y) + clamp(int(pitch+90), 0, 180)*360;
+        }
+
+        // same layout as the client's sendposition, standing on the floor with no falling velocity
+        void putposition(packetbuf &q)
+        {
+            putint(q, N_POS);
+            putuint(q, cn);
+            q.put(PHYS_FLOOR | ((lifesequence&1)<<3) | (1<<4));
+            ivec io = ivec(vec(o).mul(DMF));
+            uint mag = min(int(vel.magnitude()*DVELF), 0xFFFF), flags = 0;
+            loopk(3) if(io[k] < 0 || io[k] > 0xFFFF) flags |= 1<<k;
+            if(mag > 0xFF) flags |= 1<<3;
+            putuint(q, flags);
+            loopk(3)
+            {
+                q.put(io[k]&0xFF);
+                q.put((io[k]>>8)&0xFF);
+                if(io[k] < 0 || io[k] > 0xFFFF) q.put((io[k]>>16)&0xFF);
+            }
+            uint dir = packdir(yaw, 0);
+            q.put(dir&0xFF);
+            q.put((dir>>8)&0xFF);
+            q.put(90);
+            q.put(mag&0xFF);
+            if(mag > 0xFF) q.put((mag>>8)&0xFF);
+            uint veldir = packdir(vel.x || vel.y ? atan2f(vel.y, vel.x)/RAD - 90 : 0, 0);
+            q.put(veldir&0xFF);
+            q.put((veldir>>8)&0xFF);
+        }
+
+        // fires at another swarm member, claiming a hit so the server runs its full validation path
+        void putshot(packetbuf &q, uint now, const loadclient *target)
+        {
+            int atk = guns[gunselect].attacks[ACT_PRIMARY];
+            if(!validatk(atk)) atk = ATK_PISTOL1;
+            vec from = vec(o).add(vec(0, 0, 14)), to = target ? vec(target->o).add(vec(0, 0, 8)) : vec(o).add(vec(yaw*RAD, 0).mul(256));
+            putint(q, N_SHOOT);
+            putint(q, int((now - start)/1000));
+            putint(q, atk);
+            loopk(3) putint(q, int(from[k]*DMF));
+            loopk(3) putint(q, int(to[k]*DMF));
+            if(target)
+            {
+                vec dir = vec(to).sub(from).safenormalize();
+                putint(q, 1);
+                putint(q, target->cn);
+                putint(q, target->lifesequence);
+                putint(q, int(to.dist(from)*DMF));
+                putint(q, 1);
+                putint(q, 0);
+                loopk(3) putint(q, int(dir[k]*DNF));
+            }
+            else putint(q, 0);
+        }
+
+        void connect()
+        {
+            packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+            defformatstring(name, "load%d", num);
+            putint(p, N_CONNECT);
+            sendstring(name, p);
+            putint(p, 0);
+            putint(p, num%8);
+            sendstring("", p);
+            sendstring("", p);
+            sendstring("", p);
+            sendstring("", p);
+            send(1, p);
+        }
+
+        static void skipints(ucharbuf &p, int n) { loopi(n) getint(p); }
+
+        // same layout as the client's parsestate, without the resume fields
+        static void skipstate(ucharbuf &p) { skipints(p, 5 + NUMGUNS); }
+
+        void spawned(int ls, int gun)
+        {
+            lifesequence = ls;
+            gunselect = gun;
+            alive = true;
+            packetbuf q(16, ENET_PACKET_FLAG_RELIABLE);
+            putint(q, N_SPAWN);
+            putint(q, lifesequence);
+            putint(q, gunselect);
+            send(1, q);
+        }
+
+        // walks the reliable stream like the client's parsemessages, stopping at anything a swarm in a plain game is not sent
+        void parsemessages(ucharbuf &p, uint now)
+        {
+            char text[MAXTRANS];
+            while(p.remaining() && !p.overread()) switch(getint(p))
+            {
+                case N_SERVINFO:
+                {
+                    int mycn = getint(p);
+                    skipints(p, 3);
+                    getstring(text, p);
+                    getstring(text, p);
+                    if(cn < 0 && !p.overread())
+                    {
+                        cn = mycn;
+                        connect();
+                    }
+                    break;
+                }
+
+                case N_WELCOME:
+                    if(!joined)
+                    {
+                        joined = true;
+                        start = lastpos = lastshot = lastping = lastspawn = now;
+                        lasttext = now - rnd(textrate)*1000;
+                        if(posdelta)
+                        {
+                            packetbuf q(16, ENET_PACKET_FLAG_RELIABLE);
+                            putint(q, N_POSACK);
+                            putint(q, -1);
+                            send(1, q);
+                        }
+                    }
+                    break;
+
+                case N_PONG:
+                {
+                    int millis = getint(p);
+                    if(!p.overread()) rtts.add(int(now - uint(millis)));
+                    break;
+                }
+
+                case N_SPAWNSTATE:
+                {
+                    int scn = getint(p), ls = getint(p);
+                    skipints(p, 3);
+                    int gun = getint(p);
+                    skipints(p, NUMGUNS);
+                    if(p.overread()) return;
+                    if(joined && scn == cn && validgun(gun)) spawned(ls, gun);
+                    break;
+                }
+
+                case N_CLIENT:
+                {
+                    getint(p);
+                    int len = getuint(p);
+                    ucharbuf q = p.subbuf(len);
+                    parsemessages(q, now);
+                    break;
+                }
+
+                case N_MAPCHANGE:
+                    getstring(text, p);
+                    skipints(p, 4);
+                    break;
+
+                case N_ITEMLIST:
+                    while(getint(p) >= 0 && !p.overread()) getint(p);
+                    break;
+
+                case N_CURRENTMASTER:
+                    getint(p);
+                    while(getint(p) >= 0 && !p.overread()) getint(p);
+                    break;
+
+                case N_RESUME:
+                    while(getint(p) >= 0 && !p.overread())
+                    {
+                        skipints(p, 8);
+                        skipstate(p);
+                    }
+                    break;
+
+                case N_INITCLIENT:
+                    skipints(p, 2);
+                    getstring(text, p);
+                    skipints(p, 3);
+                    getstring(text, p);
+                    getstring(text, p);
+                    break;
+
+                case N_COUNTRY:
+                    getint(p);
+                    getstring(text, p);
+                    getstring(text, p);
+                    break;
+
+                case N_TEXT: case N_WHISPER: case N_ANNOUNCE:
+                    getint(p);
+                    getstring(text, p);
+                    break;
+
+                case N_SAYTEAM:
+                    getint(p);
+                    getstring(text, p);
+                    getint(p);
+                    break;
+
+                case N_SERVMSG: case N_SWITCHNAME:
+                    getstring(text, p);
+                    break;
+
+                case N_SPAWN: skipstate(p); break;
+                case N_TEAMINFO: skipints(p, MAXTEAMS); break;
+                case N_TAUNT: break;
+
+                case N_SOUND: case N_CDIS: case N_FORCEDEATH: case N_CLIENTPING: case N_GUNSELECT: case N_SWITCHMODEL: case N_SWITCHCOLOR:
+                case N_ITEMSPAWN: case N_ROUND: case N_MASTERMODE: case N_EDITMODE:
+                    getint(p);
+                    break;
+
+                case N_SCORE: case N_TIMEUP: case N_PAUSEGAME: case N_GAMESPEED: case N_SHOTEVENT: case N_REGENERATE: case N_ITEMACC: case N_VOOSH:
+                    skipints(p, 2);
+                    break;
+
+                case N_SETTEAM: case N_SPECTATOR: case N_REPAMMO: case N_EXPLODEFX: case N_ASSIGNROLE: skipints(p, 3); break;
+                case N_DIED: case N_HITPUSH: skipints(p, 6); break;
+                case N_SHOTFX: case N_DAMAGE: skipints(p, 10); break;
+
+                default: return;
+            }
+        }
+
+        void receive(int chan, ENetPacket *packet, uint now)
+        {
+            received += packet->dataLength;
+            ucharbuf p(packet->data, packet->dataLength);
+            if(chan == 0)
+            {
+                if(lastworld) ticks.add(int(now - lastworld));
+                lastworld = now;
+                // acknowledge delta frames at once so the server always encodes against a recent baseline
+                if(posdelta && getint(p) == N_POSDELTA)
+                {
+                    int seq = getint(p);
+                    if(p.overread()) return;
+                    packetbuf q(16);
+                    putint(q, N_POSACK);
+                    putint(q, seq);
+                    send(1, q);
+                }
+            }
+            else if(chan == 1) parsemessages(p, now);
+        }
+
+        void update(uint now, vector<loadclient *> &clients)
+        {
+            if(!joined) return;
+            if(now - lastpos >= uint(posrate)*1000)
+            {
+                lastpos = now;
+                move((now - start)/1e6f);
+                if(alive)
+                {
+                    packetbuf q(100);
+                    putposition(q);
+                    send(0, q);
+                }
+            }
+            packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+            if(alive && now - lastshot >= uint(shotrate)*1000)
+            {
+                lastshot = now;
+                loadclient *target = clients[rnd(clients.length())];
+                putshot(p, now, target != this && target->alive && target->cn >= 0 ? target : NULL);
+            }
+            if(now - lasttext >= uint(textrate)*1000)
+            {
+                lasttext = now;
+                defformatstring(msg, "%s load test message from client %d", patternnames[pattern], num);
+                putint(p, N_TEXT);
+                sendstring(msg, p);
+            }
+            if(now - lastspawn >= 1000000)
+            {
+                lastspawn = now;
+                putint(p, N_TRYSPAWN);
+            }
+            if(p.length()) send(1, p);
+            if(now - lastping >= uint(pingrate)*1000)
+            {
+                lastping = now;
+                packetbuf q(16, ENET_PACKET_FLAG_RELIABLE);
+                putint(q, N_PING);
+                putint(q, int(now));
+                send(1, q);
+            }
+        }
+    };
+
+    static int percentile(vector<int> &vals, float p)
+    {
+        if(vals.empty()) return 0;
+        return vals[clamp(int(vals.length()*p), 0, vals.length()-1)];
+    }
+
+    static void report(vector<loadclient *> &clients, uint elapsed, ENetHost *client)
+    {
+        vector<int> rtts, ticks;
+        ullong sent = 0, received = 0;
+        int joined = 0;
+        loopv(clients)
+        {
+            loadclient &c = *clients[i];
+            if(c.joined) joined++;
+            rtts.put(c.rtts.getbuf(), c.rtts.length());
+            ticks.put(c.ticks.getbuf(), c.ticks.length());
+            sent += c.sent;
+            received += c.received;
+        }
+        rtts.sort();
+        ticks.sort();
+        double secs = max(elapsed/1e6, 1e-3), mean = 0, var = 0;
+        loopv(ticks) mean += ticks[i];
+        if(ticks.length()) mean /= ticks.length();
+        loopv(ticks) var += (ticks[i] - mean)*(ticks[i] - mean);
+        if(ticks.length()) var /= ticks.length();
+        int n = max(joined, 1);
+        conoutf("%d/%d clients joined, ran %.1f s", joined, clients.length(), secs);
+        conoutf("server rtt: %d samples, p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms",
+            rtts.length(), percentile(rtts, 0.5f)/1000.0f, percentile(rtts, 0.95f)/1000.0f, percentile(rtts, 0.99f)/1000.0f, percentile(rtts, 1)/1000.0f);
+        conoutf("worldstate interval: %d samples, mean %.2f ms, stddev %.2f ms, p99 %.2f ms, max %.2f ms",
+            ticks.length(), mean/1000, sqrt(var)/1000, percentile(ticks, 0.99f)/1000.0f, percentile(ticks, 1)/1000.0f);
+        conoutf("payload per client: %.1f B/s sent, %.1f B/s received",
+            sent/secs/n, received/secs/n);
+        conoutf("wire per client: %.1f B/s sent, %.1f B/s received",
+            client->totalSentData/secs/n, client->totalReceivedData/secs/n);
+    }
+
+    static bool option(const char *opt)
+    {
+        switch(opt[1])
+        {
+            case 'h': copystring(host, opt+2); return true;
+            case 'p': port = clamp(atoi(opt+2), 1, 0xFFFF); return true;
+            case 'n': numclients = clamp(atoi(opt+2), 1, MAXCLIENTS); return true;
+            case 't': duration = max(atoi(opt+2), 1); return true;
+            case 'r': posrate = clamp(atoi(opt+2), 1, 1000); return true;
+            case 's': shotrate = clamp(atoi(opt+2), 1, 60000); return true;
+            case 'm': textrate = clamp(atoi(opt+2), 1, 600000); return true;
+            case 'd': posdelta = atoi(opt+2) != 0 || !opt[2]; return true;
+            default: return false;
+        }
+    }
+
+    static int run()
+    {
+        ENetAddress address;
+        if(enet_address_set_host(&address, host) < 0) fatal("could not resolve %s", host);
+        address.port = port;
+        ENetHost *client = enet_host_create(NULL, numclients, NUMCHANNELS, 0, 0);
+        if(!client) fatal("could not create client host");
+        vector<loadclient *> clients;
+        loopi(numclients)
+        {
+            loadclient *c = new loadclient(i);
+            c->peer = enet_host_connect(client, &address, NUMCHANNELS, 0);
+            if(!c->peer) fatal("could not open connection %d", i);
+            c->peer->data = c;
+            clients.add(c);
+        }
+        conoutf("load testing %s:%d with %d clients for %d s", host, port, numclients, duration);
+        uint start = getmicros(), now = start;
+        while(now - start < uint(duration)*1000000)
+        {
+            ENetEvent event;
+            for(int serviced = enet_host_service(client, &event, 1); serviced > 0; serviced = enet_host_check_events(client, &event))
+            {
+                now = getmicros();
+                loadclient *c = (loadclient *)event.peer->data;
+                switch(event.type)
+                {
+                    case ENET_EVENT_TYPE_CONNECT: c->connected = true; break;
+                    case ENET_EVENT_TYPE_RECEIVE:
+                        c->receive(event.channelID, event.packet, now);
+                        enet_packet_destroy(event.packet);
+                        break;
+                    case ENET_EVENT_TYPE_DISCONNECT:
+                        conoutf("client %d disconnected (reason %u)", c->num, event.data);
+                        c->connected = c->joined = c->alive = false;
+                        break;
+                    default: break;
+                }
+            }
+            now = getmicros();
+            loopv(clients) if(clients[i]->connected) clients[i]->update(now, clients);
+            enet_host_flush(client);
+        }
+        report(clients, now - start, client);
+        loopv(clients) if(clients[i]->connected) enet_peer_disconnect_now(clients[i]->peer, DISC_NONE);
+        enet_host_flush(client);
+        enet_host_destroy(client);
+        clients.deletecontents();
+        return EXIT_SUCCESS;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(enet_initialize() < 0) fatal("unable to initialise network module");
+    atexit(enet_deinitialize);
+    seedMT(time(NULL));
+    for(int i = 1; i < argc; i++) if(argv[i][0] != '-' || !loadtest::option(argv[i]))
+    {
+        printf("usage: %s [-hHOST] [-pPORT] [-nCLIENTS] [-tSECONDS] [-rPOSMILLIS] [-sSHOTMILLIS] [-mTEXTMILLIS] [-d]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    return loadtest::run();
+}
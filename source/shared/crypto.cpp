@@ -415,6 +415,218 @@ template<int BI_DIGITS> struct bigint
 
 typedef bigint<GF_DIGITS+1> gfint;
 
+#if (GF_BITS==192 || GF_BITS==256) && defined(__SIZEOF_INT128__)
+#define GF_LIMBS (GF_BITS/64)
+#define GF_LIMB_DIGITS (64/BI_DIGIT_BITS)
+
+typedef unsigned __int128 gfwide;
+
+static bool gflimbsenabled = true;
+
+/* Fully reduced field elements held in 64-bit limbs for the NIST primes with a word-aligned Solinas reduction.
+ * Only used where 128-bit products are available, everything else falls back to the generic bigint code.
+ */
+struct gflimbs
+{
+    static const ullong P[GF_LIMBS];
+
+    ullong l[GF_LIMBS];
+
+    void zero() { memset(l, 0, sizeof(l)); }
+    void one() { zero(); l[0] = 1; }
+
+    bool iszero() const
+    {
+        loopi(GF_LIMBS) if(l[i]) return false;
+        return true;
+    }
+
+    bool isone() const
+    {
+        if(l[0] != 1) return false;
+        for(int i = 1; i < GF_LIMBS; i++) if(l[i]) return false;
+        return true;
+    }
+
+    bool reducible() const
+    {
+        loopirev(GF_LIMBS) if(l[i] != P[i]) return l[i] > P[i];
+        return true;
+    }
+
+    ullong addP()
+    {
+        ullong carry = 0;
+        loopi(GF_LIMBS)
+        {
+            gfwide sum = gfwide(l[i]) + P[i] + carry;
+            l[i] = ullong(sum);
+            carry = ullong(sum>>64);
+        }
+        return carry;
+    }
+
+    ullong subP()
+    {
+        ullong borrow = 0;
+        loopi(GF_LIMBS)
+        {
+            gfwide diff = gfwide(l[i]) - P[i] - borrow;
+            l[i] = ullong(diff);
+            borrow = ullong(diff>>64)&1;
+        }
+        return borrow;
+    }
+
+    bool from(const gfint &x)
+    {
+        if(x.len > GF_LIMBS*GF_LIMB_DIGITS) return false;
+        zero();
+        loopi(x.len) l[i/GF_LIMB_DIGITS] |= ullong(x.digits[i]) << (BI_DIGIT_BITS*(i%GF_LIMB_DIGITS));
+        return !reducible();
+    }
+
+    void to(gfint &x) const
+    {
+        loopi(GF_LIMBS*GF_LIMB_DIGITS) x.digits[i] = gfint::digit(l[i/GF_LIMB_DIGITS] >> (BI_DIGIT_BITS*(i%GF_LIMB_DIGITS)));
+        x.shrinkdigits(GF_LIMBS*GF_LIMB_DIGITS);
+    }
+
+    gflimbs &add(const gflimbs &x, const gflimbs &y)
+    {
+        ullong carry = 0;
+        loopi(GF_LIMBS)
+        {
+            gfwide sum = gfwide(x.l[i]) + y.l[i] + carry;
+            l[i] = ullong(sum);
+            carry = ullong(sum>>64);
+        }
+        if(carry || reducible()) subP();
+        return *this;
+    }
+    gflimbs &add(const gflimbs &y) { return add(*this, y); }
+
+    gflimbs &mul2(const gflimbs &x) { return add(x, x); }
+    gflimbs &mul2() { return mul2(*this); }
+
+    gflimbs &sub(const gflimbs &x, const gflimbs &y)
+    {
+        ullong borrow = 0;
+        loopi(GF_LIMBS)
+        {
+            gfwide diff = gfwide(x.l[i]) - y.l[i] - borrow;
+            l[i] = ullong(diff);
+            borrow = ullong(diff>>64)&1;
+        }
+        if(borrow) addP();
+        return *this;
+    }
+    gflimbs &sub(const gflimbs &y) { return sub(*this, y); }
+
+    gflimbs &div2()
+    {
+        ullong carry = l[0]&1 ? addP() : 0;
+        loopi(GF_LIMBS-1) l[i] = (l[i]>>1) | (l[i+1]<<63);
+        l[GF_LIMBS-1] = (l[GF_LIMBS-1]>>1) | (carry<<63);
+        return *this;
+    }
+
+    gflimbs &mul(const gflimbs &x, const gflimbs &y)
+    {
+        ullong w[2*GF_LIMBS];
+        loopi(GF_LIMBS)
+        {
+            ullong carry = 0;
+            loopj(GF_LIMBS)
+            {
+                gfwide prod = gfwide(x.l[i]) * y.l[j] + (i ? w[i+j] : 0) + carry;
+                w[i+j] = ullong(prod);
+                carry = ullong(prod>>64);
+            }
+            w[i+GF_LIMBS] = carry;
+        }
+        reduce(w);
+        return *this;
+    }
+    gflimbs &mul(const gflimbs &y) { return mul(*this, y); }
+
+    gflimbs &square(const gflimbs &x) { return mul(x, x); }
+    gflimbs &square() { return square(*this); }
+
+    void reduce(const ullong *w)
+    {
+#if GF_BITS==192
+        // B = T + S1 + S2 + S3 mod p, with 2^192 = 2^64 + 1 folding the carry back in
+        gfwide acc = gfwide(w[0]) + w[3] + w[5];
+        l[0] = ullong(acc);
+        acc = (acc>>64) + w[1] + w[3] + w[4] + w[5];
+        l[1] = ullong(acc);
+        acc = (acc>>64) + w[2] + w[4] + w[5];
+        l[2] = ullong(acc);
+        ullong carry = ullong(acc>>64);
+        while(carry)
+        {
+            acc = gfwide(l[0]) + carry;
+            l[0] = ullong(acc);
+            acc = (acc>>64) + l[1] + carry;
+            l[1] = ullong(acc);
+            acc = (acc>>64) + l[2];
+            l[2] = ullong(acc);
+            carry = ullong(acc>>64);
+        }
+#elif GF_BITS==256
+        // B = T + 2*S1 + 2*S2 + S3 + S4 - D1 - D2 - D3 - D4 mod p, summed per 32-bit word
+        llong c[16];
+        loopi(8) { c[2*i] = llong(w[i]&0xFFFFFFFFULL); c[2*i+1] = llong(w[i]>>32); }
+        llong r[8] =
+        {
+            c[0] + c[8] + c[9] - c[11] - c[12] - c[13] - c[14],
+            c[1] + c[9] + c[10] - c[12] - c[13] - c[14] - c[15],
+            c[2] + c[10] + c[11] - c[13] - c[14] - c[15],
+            c[3] + 2*(c[11] + c[12]) + c[13] - c[15] - c[8] - c[9],
+            c[4] + 2*(c[12] + c[13]) + c[14] - c[9] - c[10],
+            c[5] + 2*(c[13] + c[14]) + c[15] - c[10] - c[11],
+            c[6] + 3*c[14] + 2*c[15] + c[13] - c[8] - c[9],
+            c[7] + 3*c[15] + c[8] - c[10] - c[11] - c[12] - c[13]
+        };
+        llong carry = 0;
+        uint words[8];
+        loopi(8)
+        {
+            carry += r[i];
+            words[i] = uint(carry);
+            carry >>= 32;
+        }
+        loopi(4) l[i] = ullong(words[2*i]) | (ullong(words[2*i+1])<<32);
+        while(carry < 0) carry += llong(addP());
+        while(carry > 0) carry -= llong(subP());
+#else
+#error Unsupported GF
+#endif
+        while(reducible()) subP();
+    }
+
+    template<int Y_DIGITS> gflimbs &pow(const gflimbs &x, const bigint<Y_DIGITS> &y)
+    {
+        gflimbs a = x;
+        if(y.hasbit(0)) *this = a;
+        else one();
+        for(int i = 1, j = y.numbits(); i < j; i++)
+        {
+            a.square();
+            if(y.hasbit(i)) mul(a);
+        }
+        return *this;
+    }
+};
+
+#if GF_BITS==192
+const ullong gflimbs::P[GF_LIMBS] = { 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL };
+#elif GF_BITS==256
+const ullong gflimbs::P[GF_LIMBS] = { 0xFFFFFFFFFFFFFFFFULL, 0x00000000FFFFFFFFULL, 0x0000000000000000ULL, 0xFFFFFFFF00000001ULL };
+#endif
+#endif
+
 /* NIST prime Galois fields.
  * Currently only supports NIST P-192, where P=2^192-2^64-1, and P-256, where P=2^256-2^224+2^192+2^96-1.
  */
@@ -590,6 +802,16 @@ struct gfield : gfint
 
     template<int X_DIGITS, int Y_DIGITS> gfield &pow(const bigint<X_DIGITS> &x, const bigint<Y_DIGITS> &y)
     {
+#ifdef GF_LIMBS
+        gflimbs lx;
+        if(gflimbsenabled && x.len <= GF_DIGITS && lx.from(gfint(x)))
+        {
+            gflimbs r;
+            r.pow(lx, y);
+            r.to(*this);
+            return *this;
+        }
+#endif
         gfield a(x);
         if(y.hasbit(0)) *this = a;
         else
@@ -610,6 +832,18 @@ struct gfield : gfint
     bool invert(const gfield &x)
     {
         if(!x.len) return false;
+#ifdef GF_LIMBS
+        gflimbs lx;
+        if(gflimbsenabled && lx.from(x))
+        {
+            // Fermat inversion, x^(P-2), is cheaper than the binary extended gcd once multiplies are fast
+            static const gfint Psub2(gfint(P).sub(bigint<1>(2)));
+            gflimbs r;
+            r.pow(lx, Psub2);
+            r.to(*this);
+            return true;
+        }
+#endif
         gfint u(x), v(P), A((gfint::digit)1), C((gfint::digit)0);
         while(!u.iszero())
         {
@@ -749,8 +983,11 @@ struct ecjacobian
         y.sub(f, x).sub(x).mul(b).sub(e.mul(a).mul(d)).div2();
     }
 
+    bool mulfast(const ecjacobian &p, const gfint &q);
+
     template<int Q_DIGITS> void mul(const ecjacobian &p, const bigint<Q_DIGITS> &q)
     {
+        if(q.len <= GF_DIGITS+1 && mulfast(p, gfint(q))) return;
         *this = origin;
         loopirev(q.numbits())
         {
@@ -838,6 +1075,145 @@ const ecjacobian ecjacobian::base(
 #error Unsupported GF
 #endif
 
+#ifdef GF_LIMBS
+struct eclimbs
+{
+    gflimbs x, y, z;
+
+    void origin() { x.one(); y.one(); z.zero(); }
+
+    bool from(const ecjacobian &p) { return x.from(p.x) && y.from(p.y) && z.from(p.z); }
+
+    void to(ecjacobian &p) const { x.to(p.x); y.to(p.y); z.to(p.z); }
+
+    void mul2()
+    {
+        if(z.iszero()) return;
+        else if(y.iszero()) { origin(); return; }
+        gflimbs a, b, c, d;
+        d.sub(x, c.square(z));
+        d.mul(c.add(x));
+        c.mul2(d).add(d);
+        z.mul(y).add(z);
+        a.square(y);
+        b.mul2(a);
+        d.mul2(x).mul(b);
+        x.square(c).sub(d).sub(d);
+        a.square(b).add(a);
+        y.sub(d, x).mul(c).sub(a);
+    }
+
+    void add(const eclimbs &q)
+    {
+        if(q.z.iszero()) return;
+        else if(z.iszero()) { *this = q; return; }
+        gflimbs a, b, c, d, e, f;
+        a.square(z);
+        b.mul(q.y, a).mul(z);
+        a.mul(q.x);
+        if(q.z.isone())
+        {
+            c.add(x, a);
+            d.add(y, b);
+            a.sub(x, a);
+            b.sub(y, b);
+        }
+        else
+        {
+            f.mul(y, e.square(q.z)).mul(q.z);
+            e.mul(x);
+            c.add(e, a);
+            d.add(f, b);
+            a.sub(e, a);
+            b.sub(f, b);
+        }
+        if(a.iszero()) { if(b.iszero()) mul2(); else origin(); return; }
+        if(!q.z.isone()) z.mul(q.z);
+        z.mul(a);
+        x.square(b).sub(f.mul(c, e.square(a)));
+        y.sub(f, x).sub(x).mul(b).sub(e.mul(a).mul(d)).div2();
+    }
+};
+
+static inline int scalarnibble(const gfint &q, int i)
+{
+    int digit = i/(BI_DIGIT_BITS/4);
+    return digit < q.len ? (q.digits[digit] >> (4*(i%(BI_DIGIT_BITS/4)))) & 0xF : 0;
+}
+
+#define GF_COMB_WINDOWS (GF_BITS/4)
+
+/* Affine multiples j*16^i*base for every 4-bit window i of a scalar, so multiplying the base point is only additions. */
+struct basecomb
+{
+    eclimbs points[GF_COMB_WINDOWS][15];
+
+    basecomb()
+    {
+        ecjacobian w(ecjacobian::base);
+        loopi(GF_COMB_WINDOWS)
+        {
+            ecjacobian m(w);
+            loopj(15)
+            {
+                ecjacobian a(m);
+                a.normalize();
+                points[i][j].from(a);
+                m.add(w);
+            }
+            loopk(4) w.mul2();
+        }
+    }
+
+    void mul(eclimbs &r, const gfint &q) const
+    {
+        r.origin();
+        loopi(GF_COMB_WINDOWS)
+        {
+            int n = scalarnibble(q, i);
+            if(n) r.add(points[i][n-1]);
+        }
+    }
+};
+
+static const basecomb &getbasecomb()
+{
+    static const basecomb comb;
+    return comb;
+}
+#endif
+
+bool ecjacobian::mulfast(const ecjacobian &p, const gfint &q)
+{
+#ifdef GF_LIMBS
+    if(!gflimbsenabled || q.numbits() > GF_BITS) return false;
+    eclimbs r;
+    if(p.x == base.x && p.y == base.y && p.z == base.z) getbasecomb().mul(r, q);
+    else
+    {
+        // fixed 4-bit windows over the small table of multiples 0..15 of p
+        eclimbs table[16];
+        if(!table[1].from(p)) return false;
+        table[0].origin();
+        for(int i = 2; i < 16; i++)
+        {
+            table[i] = table[i-1];
+            table[i].add(table[1]);
+        }
+        r.origin();
+        for(int i = (q.numbits()+3)/4 - 1; i >= 0; i--)
+        {
+            loopk(4) r.mul2();
+            r.add(table[scalarnibble(q, i)]);
+        }
+    }
+    r.to(*this);
+    return true;
+#else
+    return false;
+#endif
+}
+
 void calcpubkey(gfint privkey, vector<char> &pubstr)
 {
     ecjacobian c(ecjacobian::base);
@@ -944,3 +1320,61 @@ bool checkchallenge(const char *answerstr, void *correct)
     return answer == *(gfint *)correct;
 }
 
+
+// times generating and answering challenges with the limb arithmetic against the generic bigint code, checking they agree
+static void cryptobench(int n)
+{
+    n = max(n, 1);
+    vector<char> privstr, pubstr;
+    genprivkey("cryptobench", privstr, pubstr);
+    void *pubkey = parsepubkey(pubstr.getbuf());
+    vector<char> output[2], answer;
+    int failed = 0;
+#ifdef GF_LIMBS
+    enet_uint32 setup = enet_time_get();
+    getbasecomb();
+    setup = enet_time_get() - setup;
+    const int modes = 2;
+#else
+    const int modes = 1;
+#endif
+    loop(mode, modes)
+    {
+#ifdef GF_LIMBS
+        gflimbsenabled = mode > 0;
+#endif
+        vector<void *> correct;
+        vector<char> challenges;
+        enet_uint32 start = enet_time_get();
+        loopi(n)
+        {
+            uint seed[3] = { uint(i), uint(n), 0x5EED };
+            correct.add(genchallenge(pubkey, seed, sizeof(seed), challenges));
+        }
+        enet_uint32 gentime = enet_time_get() - start;
+        start = enet_time_get();
+        for(const char *c = challenges.getbuf(); c < challenges.getbuf() + challenges.length(); c += strlen(c) + 1)
+            answerchallenge(privstr.getbuf(), c, answer);
+        enet_uint32 answertime = enet_time_get() - start;
+        const char *a = answer.getbuf();
+        loopv(correct)
+        {
+            if(!checkchallenge(a, correct[i])) failed++;
+            freechallenge(correct[i]);
+            a += strlen(a) + 1;
+        }
+        output[mode].put(challenges.getbuf(), challenges.length());
+        output[mode].put(answer.getbuf(), answer.length());
+        answer.setsize(0);
+        conoutf("cryptobench: %s arithmetic, %.3f ms per challenge, %.3f ms per answer", mode ? "64-bit limb" : "generic", gentime/float(n), answertime/float(n));
+    }
+#ifdef GF_LIMBS
+    gflimbsenabled = true;
+    bool agree = output[0].length() == output[1].length() && !memcmp(output[0].getbuf(), output[1].getbuf(), output[0].length());
+    conoutf("cryptobench: base point table built in %u ms, %d failed answers, outputs %s", setup, failed, agree ? "identical" : "DIFFER");
+#else
+    conoutf("cryptobench: %d failed answers", failed);
+#endif
+    freepubkey(pubkey);
+}
+ICOMMAND(cryptobench, "i", (int *n), cryptobench(*n ? *n : 1000));
@@ -463,12 +463,29 @@ extern void cleanragdoll(dynent *d);
 
 extern int maxclients;
 
+#define CONNECT_COMPRESS (1<<0) // connect data flag asking the server to compress what it sends
+
 enum { DISC_NONE = 0, DISC_EOP, DISC_LOCAL, DISC_KICK, DISC_MSGERR, DISC_IPBAN, DISC_PRIVATE, DISC_MAXCLIENTS, DISC_TIMEOUT, DISC_OVERFLOW, DISC_PASSWORD, DISC_NUM };
 
 extern void *getclientinfo(int i);
 extern ENetPeer *getclientpeer(int i);
 extern ENetPacket *sendf(int cn, int chan, const char *format, ...);
 extern ENetPacket *sendfile(int cn, int chan, stream *file, const char *format = "", ...);
+
+#define MSGPACKETSIZE 64 // storage of pooled packets that typed messages are written into
+
+extern ENetPacket *newmsgpacket(bool reliable);
+extern ENetPacket *sendmsgpacket(int cn, int chan, ENetPacket *packet, int len, int exclude);
+
+// typed counterpart of sendf for hot messages: sendtyped(cn, chan, reliable, exclude, fields...)
+template<class... T> static inline ENetPacket *sendtyped(int cn, int chan, bool reliable, int exclude, T... fields)
+{
+    static_assert(msgsize<T...>::MAXSIZE <= MSGPACKETSIZE, "message does not fit pooled packet storage");
+    ENetPacket *packet = newmsgpacket(reliable);
+    uchar *p = packet->data;
+    putmsgfields(p, fields...);
+    return sendmsgpacket(cn, chan, packet, int(p - packet->data), exclude);
+}
 extern void sendpacket(int cn, int chan, ENetPacket *packet, int exclude = -1);
 extern void flushserver(bool force);
 extern int getservermtu();
@@ -478,12 +495,34 @@ extern void localconnect();
 extern const char *disconnectreason(int reason);
 extern void disconnect_client(int n, int reason);
 extern void kicknonlocalclients(int reason = DISC_NONE);
+extern int connectvirtualclient();
+extern void processvirtualclient(int n, int chan, uchar *data, int len);
+extern void releasevirtualpackets();
+extern void disconnectvirtualclients();
 extern bool hasnonlocalclients();
 extern bool haslocalclients();
 extern void sendserverinforeply(ucharbuf &p);
 extern bool requestmaster(const char *req);
 extern bool requestmasterf(const char *fmt, ...) PRINTFARGS(1, 2);
 extern bool isdedicatedserver();
+extern void metricf(vector<char> &buf, const char *fmt, ...) PRINTFARGS(2, 3);
+extern void setupnetcompress(ENetHost *host);
+extern void netcompressbench(const vector<uchar> &data, const vector<int> &datagrams);
+
+enum { TICK_TOTAL = 0, TICK_UPDATE, TICK_EVENTS, TICK_AI, TICK_MODE, TICK_SERVICE, TICK_PARSE, TICK_WORLDSTATE, TICK_MASTER, NUMTICKPHASES };
+
+extern uint getservermicros();
+extern ullong getservernanos();
+extern void addtickphase(int phase, uint micros);
+
+struct tickscope
+{
+    int phase;
+    uint start;
+
+    tickscope(int phase) : phase(phase), start(getservermicros()) {}
+    ~tickscope() { addtickphase(phase, getservermicros() - start); }
+};
 
 // serverbrowser
 
@@ -168,6 +168,7 @@ namespace server
     extern void sendservmsg(const char *s);
     extern void serverinforeply(ucharbuf &req, ucharbuf &p);
     extern void serverupdate();
+    extern void writemetrics(vector<char> &buf);
     extern void processmasterinput(const char *cmd, int cmdlen, const char *args);
     extern void masterconnected();
     extern void masterdisconnected();
@@ -0,0 +1,157 @@
+// thread.h: portable threads, locks and lock-free queues for work moved off the server loop
+
+#ifndef __THREAD_H__
+#define __THREAD_H__
+
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+#ifdef __GNUC__
+template<class T> static inline T atomicload(const T &v) { return __atomic_load_n(&v, __ATOMIC_ACQUIRE); }
+template<class T> static inline void atomicstore(T &v, T n) { __atomic_store_n(&v, n, __ATOMIC_RELEASE); }
+static inline int atomicadd(int &v, int n) { return __atomic_add_fetch(&v, n, __ATOMIC_ACQ_REL); }
+#else
+template<class T> static inline T atomicload(const T &v) { T n = *(const volatile T *)&v; _ReadWriteBarrier(); return n; }
+template<class T> static inline void atomicstore(T &v, T n) { _ReadWriteBarrier(); *(volatile T *)&v = n; }
+static inline int atomicadd(int &v, int n) { return _InterlockedExchangeAdd((volatile long *)&v, n) + n; }
+#endif
+
+typedef int (*threadfunc)(void *data);
+
+struct threadhandle
+{
+#ifdef WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    threadfunc func;
+    void *data;
+    bool running;
+
+    threadhandle() : func(NULL), data(NULL), running(false) {}
+
+#ifdef WIN32
+    static DWORD WINAPI run(LPVOID arg) { threadhandle *t = (threadhandle *)arg; return DWORD(t->func(t->data)); }
+#else
+    static void *run(void *arg) { threadhandle *t = (threadhandle *)arg; t->func(t->data); return NULL; }
+#endif
+
+    bool start(threadfunc f, void *d)
+    {
+        if(running) return true;
+        func = f;
+        data = d;
+#ifdef WIN32
+        handle = CreateThread(NULL, 0, run, this, 0, NULL);
+        running = handle != NULL;
+#else
+        running = !pthread_create(&handle, NULL, run, this);
+#endif
+        return running;
+    }
+
+    void join()
+    {
+        if(!running) return;
+#ifdef WIN32
+        WaitForSingleObject(handle, INFINITE);
+        CloseHandle(handle);
+#else
+        pthread_join(handle, NULL);
+#endif
+        running = false;
+    }
+};
+
+struct mutex
+{
+#ifdef WIN32
+    CRITICAL_SECTION cs;
+
+    mutex() { InitializeCriticalSection(&cs); }
+    ~mutex() { DeleteCriticalSection(&cs); }
+
+    void lock() { EnterCriticalSection(&cs); }
+    void unlock() { LeaveCriticalSection(&cs); }
+#else
+    pthread_mutex_t m;
+
+    mutex() { pthread_mutex_init(&m, NULL); }
+    ~mutex() { pthread_mutex_destroy(&m); }
+
+    void lock() { pthread_mutex_lock(&m); }
+    void unlock() { pthread_mutex_unlock(&m); }
+#endif
+};
+
+// counts posted wakeups so a sleeping worker is released once per queued item
+struct semaphore
+{
+#ifdef WIN32
+    HANDLE sem;
+
+    semaphore() { sem = CreateSemaphore(NULL, 0, LONG_MAX, NULL); }
+    ~semaphore() { CloseHandle(sem); }
+
+    void post() { ReleaseSemaphore(sem, 1, NULL); }
+    void wait() { WaitForSingleObject(sem, INFINITE); }
+#else
+    pthread_mutex_t m;
+    pthread_cond_t cond;
+    int count;
+
+    semaphore() : count(0) { pthread_mutex_init(&m, NULL); pthread_cond_init(&cond, NULL); }
+    ~semaphore() { pthread_cond_destroy(&cond); pthread_mutex_destroy(&m); }
+
+    void post()
+    {
+        pthread_mutex_lock(&m);
+        count++;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&m);
+    }
+
+    void wait()
+    {
+        pthread_mutex_lock(&m);
+        while(count <= 0) pthread_cond_wait(&cond, &m);
+        count--;
+        pthread_mutex_unlock(&m);
+    }
+#endif
+};
+
+// ring buffer that one producer thread pushes to and one consumer thread pops from without locking
+template<class T, int SIZE>
+struct spscqueue
+{
+    T items[SIZE];
+    int head, tail;
+
+    spscqueue() : head(0), tail(0) {}
+
+    bool push(const T &item)
+    {
+        int cur = tail, next = (cur + 1)%SIZE;
+        if(next == atomicload(head)) return false;
+        items[cur] = item;
+        atomicstore(tail, next);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        int cur = head;
+        if(cur == atomicload(tail)) return false;
+        item = items[cur];
+        atomicstore(head, (cur + 1)%SIZE);
+        return true;
+    }
+
+    bool empty() const { return atomicload(head) == atomicload(tail); }
+};
+
+#endif
+
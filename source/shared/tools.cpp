@@ -263,3 +263,87 @@ int ipmask::print(char *buf) const
     return int(buf-start);
 }
 
+static inline enet_uint32 prefixmask(int len) { return len ? 0xFFFFFFFFU << (32 - len) : 0; }
+
+void ipmaskset::clear()
+{
+    masks.setsize(0);
+    sparse.setsize(0);
+    nodes.setsize(0);
+    node &root = nodes.add();
+    root.prefix = 0;
+    root.len = 0;
+    root.child[0] = root.child[1] = -1;
+    root.banned = false;
+}
+
+void ipmaskset::add(const ipmask &m)
+{
+    masks.add(m);
+    enet_uint32 prefix = ENET_NET_TO_HOST_32(m.ip), mask = ENET_NET_TO_HOST_32(m.mask);
+    if(~mask & (~mask + 1)) { sparse.add(m); return; }
+    int len = 0;
+    while(len < 32 && mask & (0x80000000U >> len)) len++;
+    prefix &= mask;
+    for(int n = 0;;)
+    {
+        if(nodes[n].banned) return;
+        if(nodes[n].len == len)
+        {
+            // everything below is covered now
+            nodes[n].banned = true;
+            nodes[n].child[0] = nodes[n].child[1] = -1;
+            return;
+        }
+        int bit = (prefix >> (31 - nodes[n].len)) & 1, c = nodes[n].child[bit];
+        if(c < 0)
+        {
+            node &leaf = nodes.add();
+            leaf.prefix = prefix;
+            leaf.len = len;
+            leaf.child[0] = leaf.child[1] = -1;
+            leaf.banned = true;
+            nodes[n].child[bit] = nodes.length()-1;
+            return;
+        }
+        int maxlen = min(len, nodes[c].len), common = nodes[n].len + 1;
+        enet_uint32 diff = prefix ^ nodes[c].prefix;
+        while(common < maxlen && !(diff & (0x80000000U >> common))) common++;
+        if(common == nodes[c].len) { n = c; continue; }
+        // split the edge to the child where the new prefix leaves it, or end it early if the new prefix is shorter
+        node &split = nodes.add();
+        split.prefix = prefix & prefixmask(common);
+        split.len = common;
+        split.child[0] = split.child[1] = -1;
+        split.banned = common == len;
+        int s = nodes.length()-1;
+        if(!split.banned)
+        {
+            nodes[s].child[(nodes[c].prefix >> (31 - common)) & 1] = c;
+            node &leaf = nodes.add();
+            leaf.prefix = prefix;
+            leaf.len = len;
+            leaf.child[0] = leaf.child[1] = -1;
+            leaf.banned = true;
+            nodes[s].child[(prefix >> (31 - common)) & 1] = nodes.length()-1;
+        }
+        nodes[n].child[bit] = s;
+        return;
+    }
+}
+
+bool ipmaskset::check(enet_uint32 host) const
+{
+    enet_uint32 key = ENET_NET_TO_HOST_32(host);
+    for(int n = 0; n >= 0;)
+    {
+        const node &cur = nodes[n];
+        if((key ^ cur.prefix) & prefixmask(cur.len)) break;
+        if(cur.banned) return true;
+        if(cur.len >= 32) break;
+        n = cur.child[(key >> (31 - cur.len)) & 1];
+    }
+    loopv(sparse) if(sparse[i].check(host)) return true;
+    return false;
+}
+
@@ -426,6 +426,42 @@ struct packetbuf : ucharbuf
     }
 };
 
+// packs values of arbitrary bit widths into a byte buffer, least significant bits first
+template<class T>
+struct bitbuf
+{
+    T &buf;
+    uint bits;
+    int numbits;
+
+    bitbuf(T &buf) : buf(buf), bits(0), numbits(0) {}
+
+    void putbits(uint val, int n)
+    {
+        if(n > 16) { putbits(val&0xFFFF, 16); putbits(val>>16, n-16); return; }
+        bits |= (val & ((1<<n)-1)) << numbits;
+        numbits += n;
+        for(; numbits >= 8; numbits -= 8) { buf.put(uchar(bits)); bits >>= 8; }
+    }
+
+    uint getbits(int n)
+    {
+        if(n > 16) { uint lo = getbits(16); return lo | (getbits(n-16)<<16); }
+        for(; numbits < n; numbits += 8) bits |= uint(uchar(buf.get())) << numbits;
+        uint val = bits & ((1<<n)-1);
+        bits >>= n;
+        numbits -= n;
+        return val;
+    }
+
+    void flush()
+    {
+        if(numbits > 0) buf.put(uchar(bits));
+        bits = 0;
+        numbits = 0;
+    }
+};
+
 template<class T>
 static inline float heapscore(const T &n) { return n; }
 
@@ -1444,6 +1480,46 @@ template<size_t N> static inline void getstring(char (&t)[N], ucharbuf &p) { get
 extern void filtertext(char *dst, const char *src, bool colors, bool newlines, bool whitespace, bool forcespace, size_t len);
 template<size_t N> static inline void filtertext(char (&dst)[N], const char *src, bool colors = false, bool newlines = true, bool whitespace = true, bool forcespace = false) { filtertext(dst, src, colors, newlines, whitespace, forcespace, N-1); }
 
+// typed message fields: the argument types choose the encoding and bound the size at compile time,
+// so a message is written straight into a buffer sized for its worst case without parsing a format string
+template<class T> struct msgfield
+{
+    enum { MAXSIZE = 5 };
+
+    static inline void put(uchar *&p, T v)
+    {
+        int n = int(v);
+        if(n<128 && n>-127) *p++ = n;
+        else if(n<0x8000 && n>=-0x8000) { p[0] = 0x80; p[1] = n; p[2] = n>>8; p += 3; }
+        else { p[0] = 0x81; p[1] = n; p[2] = n>>8; p[3] = n>>16; p[4] = n>>24; p += 5; }
+    }
+};
+
+template<> struct msgfield<float>
+{
+    enum { MAXSIZE = sizeof(float) };
+
+    static inline void put(uchar *&p, float f)
+    {
+        lilswap(&f, 1);
+        memcpy(p, &f, sizeof(float));
+        p += sizeof(float);
+    }
+};
+
+template<> struct msgfield<double> : msgfield<float> {};
+
+template<class... T> struct msgsize;
+template<> struct msgsize<> { enum { MAXSIZE = 0 }; };
+template<class T, class... R> struct msgsize<T, R...> { enum { MAXSIZE = msgfield<T>::MAXSIZE + msgsize<R...>::MAXSIZE }; };
+
+static inline void putmsgfields(uchar *&p) {}
+template<class T, class... R> static inline void putmsgfields(uchar *&p, T v, R... rest)
+{
+    msgfield<T>::put(p, v);
+    putmsgfields(p, rest...);
+}
+
 struct ipmask
 {
     enet_uint32 ip, mask;
@@ -1453,5 +1529,31 @@ struct ipmask
     bool check(enet_uint32 host) const { return (host & mask) == ip; }
 };
 
+// set of masks matched through a path-compressed binary trie over the prefix bits, so a check takes at most 32 steps;
+// masks with wildcards in the middle do not form a prefix and are checked one by one
+struct ipmaskset
+{
+    struct node
+    {
+        enet_uint32 prefix;
+        int len, child[2];
+        bool banned;
+    };
+
+    vector<ipmask> masks, sparse;
+    vector<node> nodes;
+
+    ipmaskset() { clear(); }
+
+    void clear();
+    void add(const ipmask &m);
+    void add(const char *name) { ipmask m; m.parse(name); add(m); }
+    void build(const vector<ipmask> &list) { clear(); loopv(list) add(list[i]); }
+    bool check(enet_uint32 host) const;
+    int length() const { return masks.length(); }
+    bool empty() const { return masks.empty(); }
+    const ipmask &operator[](int i) const { return masks[i]; }
+};
+
 #endif
 